@@ -0,0 +1,90 @@
+///////////////////////////////////////////////////////////////////////////////
+//            Copyright (C) 2004-2011 by The Allacrost Project
+//            Copyright (C) 2012-2015 by Bertram (Valyria Tear)
+//                         All Rights Reserved
+//
+// This code is licensed under the GNU GPL version 2. It is free software
+// and you may modify it and/or redistribute it under the terms of this license.
+// See http://www.gnu.org/copyleft/gpl.html for details.
+///////////////////////////////////////////////////////////////////////////////
+
+/** ***************************************************************************
+*** \file    autotiling.cpp
+*** \author  Yohann Ferreira, yohann ferreira orange fr
+*** \brief   Source file for the autotiling groups data.
+*** **************************************************************************/
+
+#include "utils/utils_common.h"
+#include "autotiling.h"
+
+#include "script/script_read.h"
+
+#include <QFileInfo>
+
+using namespace vt_script;
+
+namespace vt_editor
+{
+
+void AutotilingTable::Update(const QString &filename)
+{
+    QDateTime last_modified = QFileInfo(filename).lastModified();
+    if(filename == _filename && last_modified == _last_modified)
+        return;
+
+    _filename = filename;
+    _last_modified = last_modified;
+    _groups.clear();
+    _load_failed = !_Load();
+    _failure_reported = false;
+}
+
+const AutotileGroup *AutotilingTable::GetGroup(const std::string &group_name) const
+{
+    if(_load_failed)
+        return nullptr;
+
+    static const AutotileGroup empty_group;
+    std::unordered_map<std::string, AutotileGroup>::const_iterator it = _groups.find(group_name);
+    return it != _groups.end() ? &it->second : &empty_group;
+}
+
+bool AutotilingTable::_Load()
+{
+    ReadScriptDescriptor read_data;
+    if(!read_data.OpenFile(_filename.toStdString()))
+        return false;
+
+    // The groups are the global tables of the file. The other globals,
+    // such as the Lua libraries, don't hold any tile and are skipped.
+    std::vector<std::string> names;
+    read_data.OpenTable("_G");
+    read_data.ReadTableKeys(names);
+    for(uint32_t i = 0; i < names.size(); ++i) {
+        if(!read_data.DoesTableExist(names[i]))
+            continue;
+
+        AutotileGroup group;
+        read_data.OpenTable(names[i]);
+        uint32_t table_size = read_data.GetTableSize();
+        for(uint32_t j = 1; j <= table_size; ++j) {
+            if(!read_data.OpenTable(j))
+                continue;
+            AutotileVariant variant;
+            variant.tileset_name = QString::fromStdString(read_data.ReadString(1));
+            variant.tile_index = read_data.ReadInt(2);
+            group.push_back(variant);
+            read_data.CloseTable();
+        }
+        read_data.CloseTable();
+
+        if(!group.empty())
+            _groups[names[i]].swap(group);
+    }
+    read_data.CloseTable();
+
+    read_data.CloseFile();
+    return true;
+}
+
+} // namespace vt_editor
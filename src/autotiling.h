@@ -0,0 +1,97 @@
+///////////////////////////////////////////////////////////////////////////////
+//            Copyright (C) 2004-2011 by The Allacrost Project
+//            Copyright (C) 2012-2015 by Bertram (Valyria Tear)
+//                         All Rights Reserved
+//
+// This code is licensed under the GNU GPL version 2. It is free software
+// and you may modify it and/or redistribute it under the terms of this license.
+// See http://www.gnu.org/copyleft/gpl.html for details.
+///////////////////////////////////////////////////////////////////////////////
+
+/** ***************************************************************************
+*** \file    autotiling.h
+*** \author  Yohann Ferreira, yohann ferreira orange fr
+*** \brief   Header file for the autotiling groups data.
+*** **************************************************************************/
+
+#ifndef __AUTOTILING_HEADER__
+#define __AUTOTILING_HEADER__
+
+#include <QDateTime>
+#include <QString>
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <stdint.h>
+
+namespace vt_editor
+{
+
+//! \brief A tile which can be painted in place of any tile of its autotiling group.
+struct AutotileVariant {
+    //! \brief The tileset definition filename, as found in the map tileset list.
+    QString tileset_name;
+    //! \brief The tile index in that tileset.
+    int32_t tile_index;
+};
+
+typedef std::vector<AutotileVariant> AutotileGroup;
+
+/** ***************************************************************************
+*** \brief Keeps the autotiling groups read from the autotiling.lua file.
+***
+*** All the groups, the global tables of the file, are read at once when the
+*** file is set, and are then kept in memory. They are read again when another
+*** file is used, or when the file was modified on disk since they were read.
+*** **************************************************************************/
+class AutotilingTable
+{
+public:
+    //! \brief No file is read until one is set through Update().
+    AutotilingTable():
+        _load_failed(true),
+        _failure_reported(false)
+    {}
+
+    /** \brief Sets the autotiling file to use, and reads its groups.
+    ***
+    *** Cheap when nothing changed, it's meant to be called before each painting
+    *** operation so that changes done to the file are taken in account.
+    **/
+    void Update(const QString &filename);
+
+    /** \brief Returns the tiles of the given group, or nullptr when the file
+    *** couldn't be read. The group is empty when it isn't defined in the file.
+    **/
+    const AutotileGroup *GetGroup(const std::string &group_name) const;
+
+    /** \brief Tells whether the file couldn't be read and wasn't reported yet,
+    *** and marks it as reported. Used to only warn once until the file changes.
+    **/
+    bool ReportLoadFailure() {
+        bool report = _load_failed && !_failure_reported;
+        _failure_reported = _load_failed;
+        return report;
+    }
+
+private:
+    //! \brief The autotiling file and its modification time when the groups were read.
+    QString _filename;
+    QDateTime _last_modified;
+
+    //! \brief When true, the file couldn't be read and isn't opened again until it changes.
+    bool _load_failed;
+    bool _failure_reported;
+
+    //! \brief The groups read, by name.
+    std::unordered_map<std::string, AutotileGroup> _groups;
+
+    //! \brief Reads all the groups of the file.
+    //! \return False when the file couldn't be read.
+    bool _Load();
+};
+
+} // namespace vt_editor
+
+#endif // __AUTOTILING_HEADER__
@@ -175,6 +175,8 @@ LayerDialog::LayerDialog(QWidget *parent)
     _type_cbox->addItem("ground");
     _type_cbox->addItem("sky");
 
+    _sparse_cbox = new QCheckBox(tr("Mostly empty layer (sparse storage)"), this);
+
     // Add all of the aforementioned widgets into a nice-looking grid layout
     _dialog_layout->addWidget(_name_label,     0, 0);
     _dialog_layout->addWidget(_name_edit,      1, 0);
@@ -182,8 +184,10 @@ LayerDialog::LayerDialog(QWidget *parent)
     _dialog_layout->addWidget(_type_label,     0, 1);
     _dialog_layout->addWidget(_type_cbox,      1, 1);
 
-    _dialog_layout->addWidget(_cancel_pbut,    2, 0);
-    _dialog_layout->addWidget(_ok_pbut,        2, 1);
+    _dialog_layout->addWidget(_sparse_cbox,    2, 0, 1, 2);
+
+    _dialog_layout->addWidget(_cancel_pbut,    3, 0);
+    _dialog_layout->addWidget(_ok_pbut,        3, 1);
 } // LayerDialog constructor
 
 LayerDialog::~LayerDialog()
@@ -194,6 +198,7 @@ LayerDialog::~LayerDialog()
     delete _name_edit;
     delete _type_label;
     delete _type_cbox;
+    delete _sparse_cbox;
 
     delete _dialog_layout;
 } // LayerDialog destructor
@@ -205,6 +210,7 @@ LayerInfo LayerDialog::_GetLayerInfo()
 
     layer_info.name = _name_edit->text().toStdString();
     layer_info.layer_type = getLayerType(_type_cbox->currentText().toStdString());
+    layer_info.sparse = _sparse_cbox->isChecked();
 
     return layer_info;
 }
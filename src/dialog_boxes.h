@@ -18,6 +18,7 @@
 #ifndef __DIALOG_BOXES_HEADER__
 #define __DIALOG_BOXES_HEADER__
 
+#include <QCheckBox>
 #include <QDialog>
 #include <QGridLayout>
 #include <QLabel>
@@ -148,6 +149,9 @@ private:
     QLineEdit *_name_edit;
     QComboBox *_type_cbox;
 
+    //! Whether the layer tiles are stored in chunks, for mostly empty layers.
+    QCheckBox *_sparse_cbox;
+
     //! \brief A layout to manage all the labels, buttons, and listviews.
     QGridLayout *_dialog_layout;
 
@@ -18,9 +18,12 @@
 #include "utils/utils_common.h"
 #include "editor.h"
 
-#include <QTableWidgetItem>
 #include <QScrollBar>
 #include <QGraphicsView>
+#include <QDateTime>
+#include <QEventLoop>
+#include <QFutureWatcher>
+#include <QtConcurrent/QtConcurrentMap>
 
 using namespace vt_utils;
 using namespace vt_script;
@@ -44,6 +47,9 @@ Editor::Editor() :
     // Load settings
     _settings = new QSettings("ValyriaTear", "VT-Editor");
     _game_data_folder_path = _settings->value("GameDataPath").toString();
+    // The oldest commands are deleted past this count, 0 meaning no limit.
+    // The limit can only be set while the stack is empty.
+    _undo_stack->setUndoLimit(_settings->value("UndoLimit", 200).toInt());
 
     // Test the current game data existence and empty it if not valid anymore.
     QDir dataDir(_game_data_folder_path);
@@ -304,6 +310,11 @@ void Editor::_FileNew()
 
     if(_grid)
         delete _grid;
+    // The commands of the previous map don't apply to the new one
+    _undo_stack->clear();
+    // The new map gets a journal once saved. The previous one is kept until
+    // now, so that canceling keeps recording the changes of the current map.
+    _undo_journal.Stop(true);
     _grid = new Grid(_ed_splitter, tr("Untitled"), new_map->GetWidth(), new_map->GetHeight());
     // Set default edit mode
     _grid->_layer_id = 0;
@@ -335,9 +346,8 @@ void Editor::_FileNew()
         if(tilesets->topLevelItem(i)->checkState(0) == Qt::Checked) {
             new_map_progress->setValue(checked_items++);
 
-            TilesetTable* a_tileset = new TilesetTable();
-            if(!a_tileset->Load(tilesets->topLevelItem(i)->text(0),
-                                _game_data_folder_path.split("data").at(0))) {
+            TilesetTable* a_tileset = _LoadTileset(tilesets->topLevelItem(i)->text(0));
+            if(!a_tileset) {
                 QString tileset_full_path = _game_data_folder_path.split("data").at(0) + tilesets->topLevelItem(i)->text(0);
                 QMessageBox::critical(this, tr("Map Editor"),
                                       tr("Failed to load tileset image in: %1").arg(tileset_full_path));
@@ -356,6 +366,7 @@ void Editor::_FileNew()
         } // tileset must be checked
     } // iterate through all possible tilesets
     new_map_progress->setValue(checked_items);
+    _grid->UpdateCollisionGrid();
 
     // Set the splitters sizes
     QList<int> sizes;
@@ -455,6 +466,8 @@ void Editor::_FileOpen()
 
     if(_grid)
         delete _grid;
+    // The commands of the previous map don't apply to the new one
+    _undo_stack->clear();
     _grid = new Grid(_ed_splitter, tr("Untitled"), 0, 0);
     // Set default edit mode
     _grid->_tile_mode  = PAINT_TILE;
@@ -467,43 +480,103 @@ void Editor::_FileOpen()
 
     _UpdateLayersView();
 
-    // Count for the tileset names
-    int num_items = _grid->tileset_def_names.count();
-    int progress_steps = 0;
+    QString root_folder = _game_data_folder_path.split("data").at(0);
+
+    // Tilesets found in the cache are simply shared. The definitions of the
+    // other ones are read first. This is done here as the scripting engine
+    // can't be used from other threads.
+    std::vector<std::shared_ptr<const Tileset> > tilesets;
+    std::vector<Tileset *> loaded_tilesets;
+    QStringList image_filenames;
+    for(QStringList::ConstIterator it = _grid->tileset_def_names.begin();
+            it != _grid->tileset_def_names.end(); ++it) {
+        tilesets.push_back(_tileset_cache.Find(*it, root_folder));
+        if(tilesets.back())
+            continue;
+
+        Tileset *a_tileset = new Tileset();
+        loaded_tilesets.push_back(a_tileset);
+        if(!a_tileset->LoadDefinition(*it, root_folder)) {
+            QMessageBox::critical(this, tr("Map Editor"),
+                                  tr("Failed to load tileset: %1").arg(root_folder + (*it)));
+            statusBar()->showMessage(tr("Couldn't load map! Invalid tileset given"), 5000);
+
+            for(uint32_t i = 0; i < loaded_tilesets.size(); ++i)
+                delete loaded_tilesets[i];
+            _FileClose();
+            return;
+        }
+        image_filenames.append(root_folder + a_tileset->GetImageFilename());
+    } // iterate through all tilesets in the map
 
     // Used to show the progress of tilesets has been loaded.
     QProgressDialog *new_map_progress =
-        new QProgressDialog(tr("Loading tilesets..."), nullptr, 0, num_items, this,
-                            Qt::Widget | Qt::FramelessWindowHint | Qt::WindowTitleHint);
+        new QProgressDialog(tr("Loading tilesets..."), tr("Cancel"), 0, image_filenames.count(), this,
+                            Qt::Dialog | Qt::FramelessWindowHint | Qt::WindowTitleHint);
     new_map_progress->setWindowTitle(tr("Creating Map..."));
+    new_map_progress->setWindowModality(Qt::WindowModal);
 
     // Set the progress bar
     new_map_progress->move(this->pos().x() + this->width() / 2  - new_map_progress->width() / 2,
                             this->pos().y() + this->height() / 2 - new_map_progress->height() / 2);
     new_map_progress->show();
 
-    for(QStringList::ConstIterator it = _grid->tileset_def_names.begin();
-            it != _grid->tileset_def_names.end(); ++it) {
-        new_map_progress->setValue(progress_steps++);
+    // Then decode the tileset images on worker threads, while the event loop
+    // keeps the editor responsive and the progress dialog cancelable.
+    QEventLoop decode_loop;
+    QFutureWatcher<QImage> decode_watcher;
+    connect(&decode_watcher, SIGNAL(progressValueChanged(int)), new_map_progress, SLOT(setValue(int)));
+    connect(&decode_watcher, SIGNAL(finished()), &decode_loop, SLOT(quit()));
+    connect(new_map_progress, SIGNAL(canceled()), &decode_watcher, SLOT(cancel()));
+    decode_watcher.setFuture(QtConcurrent::mapped(image_filenames, &Tileset::DecodeImage));
+    if(!decode_watcher.isFinished())
+        decode_loop.exec();
+    decode_watcher.waitForFinished();
+
+    if(decode_watcher.isCanceled()) {
+        statusBar()->showMessage(tr("Map loading canceled"), 5000);
+
+        new_map_progress->hide();
+        delete new_map_progress;
+        for(uint32_t i = 0; i < loaded_tilesets.size(); ++i)
+            delete loaded_tilesets[i];
+        _FileClose();
+        return;
+    }
 
-        TilesetTable *a_tileset = new TilesetTable();
-        if(!a_tileset->Load(*it, _game_data_folder_path.split("data").at(0))) {
-            QString tileset_full_path = _game_data_folder_path.split("data").at(0) + (*it);
+    // Hand the decoded images over to the loaded tilesets, which are added to the cache.
+    uint32_t loaded_index = 0;
+    for(uint32_t i = 0; i < tilesets.size(); ++i) {
+        if(tilesets[i])
+            continue;
+
+        QImage image = decode_watcher.resultAt(loaded_index);
+        if(image.isNull()) {
             QMessageBox::critical(this, tr("Map Editor"),
-                                  tr("Failed to load tileset image: %1").arg(tileset_full_path));
+                                  tr("Failed to load tileset image: %1").arg(image_filenames[loaded_index]));
             statusBar()->showMessage(tr("Couldn't load map! Invalid tileset given"), 5000);
 
             // Hide and delete progress bar
             new_map_progress->hide();
             delete new_map_progress;
+            for(uint32_t j = loaded_index; j < loaded_tilesets.size(); ++j)
+                delete loaded_tilesets[j];
             _FileClose();
             return;
         }
 
-        _ed_tabs->addTab(a_tileset->table, *it);
+        loaded_tilesets[loaded_index]->SetImage(image);
+        tilesets[i] = _tileset_cache.Insert(root_folder, loaded_tilesets[loaded_index]);
+        ++loaded_index;
+    } // iterate through all tilesets in the map
+
+    // Finally, create the tileset tables.
+    for(uint32_t i = 0; i < tilesets.size(); ++i) {
+        TilesetTable *a_tileset = new TilesetTable();
+        a_tileset->LoadShared(tilesets[i]);
+        _ed_tabs->addTab(a_tileset->table, _grid->tileset_def_names[i]);
         _grid->tilesets.push_back(a_tileset);
     } // iterate through all tilesets in the map
-    new_map_progress->setValue(progress_steps);
 
     _grid->Resize(_grid->GetWidth(), _grid->GetHeight());
     _grid->UpdateScene();
@@ -536,6 +609,8 @@ void Editor::_FileOpen()
     statusBar()->showMessage(QString(tr("Opened \'%1\'")).
                                 arg(_grid->GetFileName()), 5000);
 
+    _OpenUndoJournal();
+
     setWindowTitle(QString("Map Editor - ") + _grid->GetFileName());
 
 } // void Editor::_FileOpen()
@@ -568,6 +643,9 @@ void Editor::_FileSave()
 
     _grid->SaveMap();      // actually saves the map
     _undo_stack->setClean();
+
+    // The saved map holds the journaled changes
+    _undo_journal.Start(_grid->GetFileName());
     setWindowTitle(QString("%1").arg(_grid->GetFileName()));
     statusBar()->showMessage(QString(tr("Saved \'%1\' successfully!")).
                              arg(_grid->GetFileName()), 5000);
@@ -599,6 +677,7 @@ void Editor::_FileClose()
         delete _grid;
         _grid = nullptr;
         _undo_stack->clear();
+        _undo_journal.Stop(true);
 
         // Enable appropriate actions
         _TilesEnableActions();
@@ -625,8 +704,10 @@ void Editor::_FileClose()
 void Editor::_FileQuit()
 {
     // Checks to see if the map is unsaved.
-    if(_EraseOK())
+    if(_EraseOK()) {
+        _undo_journal.Stop(true);
         qApp->exit(0);
+    }
 }
 
 void Editor::_ViewToggleGrid()
@@ -643,10 +724,10 @@ void Editor::_ViewToggleGrid()
 void Editor::_TileLayerFill()
 {
     // get reference to current tileset
-    QTableWidget *table = static_cast<QTableWidget *>(_ed_tabs->currentWidget());
+    QTableView *table = static_cast<QTableView *>(_ed_tabs->currentWidget());
 
     // put selected tile from tileset into tile array at correct position
-    int32_t tileset_index = table->currentRow() * 16 + table->currentColumn();
+    int32_t tileset_index = table->currentIndex().row() * 16 + table->currentIndex().column();
     int32_t multiplier = _grid->tileset_def_names.indexOf(_ed_tabs->tabText(_ed_tabs->currentIndex()));
 
     if(multiplier == -1) {
@@ -654,36 +735,32 @@ void Editor::_TileLayerFill()
         multiplier = _grid->tileset_def_names.indexOf(_ed_tabs->tabText(_ed_tabs->currentIndex()));
     } // calculate index of current tileset
 
-    std::vector<std::vector<int32_t> >& current_layer = _grid->GetCurrentLayer();
+    const LayerTiles& current_layer = _grid->GetCurrentLayer();
+
+    // The autotiling groups are read once for the whole fill
+    _UpdateAutotiling();
 
     // Record the information for undo/redo operations.
     std::vector<int32_t> previous;
     std::vector<int32_t> modified;
     std::vector<QPoint> indeces;;
 
-    for(uint32_t y = 0; y < current_layer.size(); ++y) {
-        for(uint32_t x = 0; x < current_layer[y].size(); ++x) {
+    for(uint32_t y = 0; y < current_layer.GetHeight(); ++y) {
+        for(uint32_t x = 0; x < current_layer.GetWidth(); ++x) {
             // Stores the indeces
             indeces.push_back(QPoint(x, y));
             previous.push_back(current_layer[y][x]);
 
-            // Fill the layer
+            // The layer is filled when the command is pushed
             _grid->_AutotileRandomize(multiplier, tileset_index);
-            current_layer[y][x] = tileset_index + multiplier * 256;
             modified.push_back(tileset_index + multiplier * 256);
         }
     }
 
-    LayerCommand *fill_command = new LayerCommand(indeces, previous, modified,
+    // Pushing the command fills the layer and redraws what changed.
+    LayerCommand *fill_command = new LayerCommand(TileDelta(indeces, previous, modified),
             _grid->_layer_id, this, "Fill Layer");
     _undo_stack->push(fill_command);
-    indeces.clear();
-    previous.clear();
-    modified.clear();
-
-    // Draw the changes.
-    _grid->SetChanged(true);
-    _grid->UpdateScene();
 } // void Editor::_TileLayerFill()
 
 void Editor::_TileLayerClear()
@@ -789,7 +866,9 @@ void Editor::_MapAddLayer()
         // Apply changes
         LayerInfo layer_info = layer_dlg->_GetLayerInfo();
 
+        GridSnapshot previous_map = _grid->GetSnapshot();
         _grid->AddLayer(layer_info);
+        _PushMapCommand(std::move(previous_map), "Add Layer");
 
         _UpdateLayersView();
 
@@ -836,7 +915,9 @@ void Editor::_MapDeleteLayer()
     }
 
     // Apply changes
+    GridSnapshot previous_map = _grid->GetSnapshot();
     _grid->DeleteLayer(layer_id);
+    _PushMapCommand(std::move(previous_map), "Delete Layer");
 
     _UpdateLayersView();
 
@@ -860,30 +941,13 @@ void Editor::_MapMoveLayerUp()
     if(layers.size() < 2 || layer_id >= layers.size())
         return;
 
-    // insert the layer before the previous one in the new vector
-    uint32_t old_id = 0;
-    std::vector<Layer> new_layers;
-    std::vector<Layer>::iterator it = layers.begin();
-    for(; it != layers.end(); ++it) {
-        // Add the layer before the previous one, plus the previous one after that
-        if(old_id == layer_id - 1) {
-            new_layers.push_back(layers.at(layer_id));
-            new_layers.push_back(*it);
-        } else if(old_id == layer_id) {
-            // The layer has already been added, so don't do anything here.
-        }
-        // Add other layers normally
-        else if(old_id != layer_id - 1) {
-            new_layers.push_back(*it);
-        }
-        ++old_id;
-    }
-    // Once done, swap the layers
-    layers.swap(new_layers);
+    // Only the layer items stacking changes on screen
+    GridSnapshot previous_map = _grid->GetSnapshot();
+    _grid->SwapLayers(layer_id - 1, layer_id);
+    _PushMapCommand(std::move(previous_map), "Move Layer Up");
 
     // Show the changes done.
     _UpdateLayersView();
-    _grid->UpdateScene();
 
     // Set the layer selection to follow the current layer
     _SetSelectedLayer(layer_id - 1);
@@ -902,30 +966,13 @@ void Editor::_MapMoveLayerDown()
     if(layers.size() < 2 || layer_id >= layers.size() - 1)
         return;
 
-    // insert the layer after the next one in the new vector
-    uint32_t old_id = 0;
-    std::vector<Layer> new_layers;
-    std::vector<Layer>::iterator it = layers.begin();
-    for(; it != layers.end(); ++it) {
-        // Add the layer after the next one, plus the previous one after that
-        if(old_id == layer_id + 1) {
-            new_layers.push_back(*it);
-            new_layers.push_back(layers.at(layer_id));
-        } else if(old_id == layer_id) {
-            // The layer has already been added, so don't do anything here.
-        }
-        // Add other layers normally
-        else if(old_id != layer_id + 1) {
-            new_layers.push_back(*it);
-        }
-        ++old_id;
-    }
-    // Once done, swap the layers
-    layers.swap(new_layers);
+    // Only the layer items stacking changes on screen
+    GridSnapshot previous_map = _grid->GetSnapshot();
+    _grid->SwapLayers(layer_id, layer_id + 1);
+    _PushMapCommand(std::move(previous_map), "Move Layer Down");
 
     // Show the changes done.
     _UpdateLayersView();
-    _grid->UpdateScene();
 
     // Set the layer selection to follow the current layer
     _SetSelectedLayer(layer_id + 1);
@@ -934,6 +981,74 @@ void Editor::_MapMoveLayerDown()
     _grid->SetChanged(true);
 }
 
+void Editor::_PushMapCommand(GridSnapshot &&previous_map, const QString &text)
+{
+    _undo_stack->push(new MapCommand(std::move(previous_map), _grid->GetSnapshot(), this, text));
+}
+
+void Editor::_OpenUndoJournal()
+{
+    QString map_filename = _grid->GetFileName();
+    bool restored = false;
+    if(UndoJournal::Exists(map_filename)) {
+        if(QMessageBox::question(this, tr("Unsaved changes found"),
+                                 tr("The changes done to this map weren't saved the last time it was edited.\n"
+                                    "Do you want to restore them?"),
+                                 QMessageBox::Yes | QMessageBox::No, QMessageBox::Yes) == QMessageBox::Yes) {
+            GridSnapshot map;
+            QStringList tileset_names;
+            // The tile ids refer to the tilesets by their index in the journaled list
+            restored = UndoJournal::Replay(map_filename, _grid, map, tileset_names) &&
+                       _SetTilesets(tileset_names);
+            if(restored)
+                _grid->RestoreSnapshot(map);
+            else
+                QMessageBox::warning(this, tr("Unsaved changes found"),
+                                     tr("The changes couldn't be restored: the map was modified since, "
+                                        "or one of its tilesets couldn't be loaded."));
+        }
+    }
+
+    _undo_journal.Start(map_filename);
+    if(!restored)
+        return;
+
+    // Keep the restored changes in the new journal
+    _undo_journal.WriteCheckpoint(_grid->GetSnapshot(), _grid->tileset_def_names);
+    _UpdateLayersView();
+    _grid->SetChanged(true);
+    statusBar()->showMessage(tr("Unsaved changes restored"), 5000);
+}
+
+bool Editor::_SetTilesets(const QStringList &tileset_names)
+{
+    if(tileset_names == _grid->tileset_def_names)
+        return true;
+
+    // Load every tileset first, so that the map is left untouched on failure
+    std::vector<Tileset *> tilesets;
+    for(int i = 0; i < tileset_names.size(); ++i) {
+        TilesetTable *a_tileset = _LoadTileset(tileset_names[i]);
+        if(!a_tileset) {
+            for(uint32_t j = 0; j < tilesets.size(); ++j)
+                delete tilesets[j];
+            return false;
+        }
+        tilesets.push_back(a_tileset);
+    }
+
+    _ed_tabs->clear();
+    for(uint32_t i = 0; i < _grid->tilesets.size(); ++i)
+        delete _grid->tilesets[i];
+    _grid->tilesets = tilesets;
+    _grid->tileset_def_names = tileset_names;
+    for(int i = 0; i < tileset_names.size(); ++i)
+        _ed_tabs->addTab(static_cast<TilesetTable *>(tilesets[i])->table, tileset_names[i]);
+
+    _grid->UpdateCollisionGrid();
+    return true;
+}
+
 void Editor::_MapProperties()
 {
     MapPropertiesDialog *props = new MapPropertiesDialog(this, _game_data_folder_path.split("data").at(0), false);
@@ -1077,10 +1192,9 @@ void Editor::_MapProperties()
             if(_grid->tileset_def_names.contains(tilesets->topLevelItem(i)->text(0)))
                 continue;
 
-            TilesetTable *a_tileset = new TilesetTable();
             QString tileset_full_path = _game_data_folder_path.split("data").at(0) + tilesets->topLevelItem(i)->text(0);
-            if (!a_tileset->Load(tilesets->topLevelItem(i)->text(0),
-                            _game_data_folder_path.split("data").at(0))) {
+            TilesetTable *a_tileset = _LoadTileset(tilesets->topLevelItem(i)->text(0));
+            if (!a_tileset) {
                 QMessageBox::critical(this, tr("Error on tilesets!"),
                                         tr("Error while loading: %1")
                                         .arg(tileset_full_path));
@@ -1114,6 +1228,12 @@ void Editor::_MapProperties()
         }
     }
 
+    // Tiles of the added tilesets may already be on the map
+    _grid->UpdateCollisionGrid();
+
+    // The journaled tile ids depend on the tileset list
+    _undo_journal.WriteCheckpoint(_grid->GetSnapshot(), _grid->tileset_def_names);
+
     delete props;
 }
 
@@ -1235,10 +1355,9 @@ void Editor::_UpdateSelectedLayer(QTreeWidgetItem *item)
 void Editor::_ToggleLayerVisibility()
 {
     Layer &layer = _grid->GetLayers()[_grid->_layer_id];
-    layer.visible = !layer.visible;
 
-    // Show the change
-    _grid->UpdateScene();
+    // Show the change, only the layer item visibility changes.
+    _grid->SetLayerVisible(_grid->_layer_id, !layer.visible);
 
     // Update the item icon
     if(layer.visible)
@@ -1447,6 +1566,30 @@ void Editor::_CreateToolbars()
     _tiles_toolbar->addAction(_toggle_select_action);
 }
 
+void Editor::_UpdateAutotiling()
+{
+    _autotiling.Update(_game_data_folder_path.split("data").at(0) + "data/tilesets/autotiling.lua");
+}
+
+TilesetTable *Editor::_LoadTileset(const QString &def_filename)
+{
+    QString root_folder = _game_data_folder_path.split("data").at(0);
+
+    std::shared_ptr<const Tileset> tileset = _tileset_cache.Find(def_filename, root_folder);
+    if(!tileset) {
+        Tileset *loaded_tileset = new Tileset();
+        if(!loaded_tileset->Load(def_filename, root_folder)) {
+            delete loaded_tileset;
+            return nullptr;
+        }
+        tileset = _tileset_cache.Insert(root_folder, loaded_tileset);
+    }
+
+    TilesetTable *a_tileset = new TilesetTable();
+    a_tileset->LoadShared(tileset);
+    return a_tileset;
+}
+
 bool Editor::_EraseOK()
 {
     if(!_grid)
@@ -1479,33 +1622,133 @@ bool Editor::_EraseOK()
 // LayerCommand class -- public functions
 ///////////////////////////////////////////////////////////////////////////////
 
-LayerCommand::LayerCommand(std::vector<QPoint> indeces, std::vector<int32_t> previous, std::vector<int32_t> modified,
-                           uint32_t layer_id, Editor *editor, const QString &text, QUndoCommand *parent) :
+LayerCommand::LayerCommand(TileDelta &&delta, uint32_t layer_id, Editor *editor,
+                           const QString &text, TILE_MODE_TYPE tile_mode, qint64 start_time,
+                           QUndoCommand *parent) :
     QUndoCommand(text, parent),
-    _tile_indeces(indeces),
-    _previous_tiles(previous),
-    _modified_tiles(modified),
+    _tile_mode(tile_mode),
+    _end_time(QDateTime::currentMSecsSinceEpoch()),
     _edited_layer_id(layer_id),
     _editor(editor)
-{}
+{
+    _start_time = start_time < 0 ? _end_time : start_time;
+    if(!delta.IsEmpty())
+        _deltas.push_back(std::move(delta));
+}
 
 void LayerCommand::undo()
 {
+    _Apply(true);
+}
+
+void LayerCommand::redo()
+{
+    _Apply(false);
+}
 
-    for(int32_t i = 0; i < static_cast<int32_t>(_tile_indeces.size()); ++i) {
-        _editor->_grid->GetLayers()[_edited_layer_id].tiles[_tile_indeces[i].y()][_tile_indeces[i].x()] = _previous_tiles[i];
+void LayerCommand::_Apply(bool undo)
+{
+    Grid *grid = _editor->_grid;
+    if(_deltas.empty() || !grid || _edited_layer_id >= grid->GetLayers().size())
+        return;
+
+    // Only the tiles whose value changed are redrawn. Nothing is when the
+    // command is first pushed after the edit was done on the map.
+    // The strokes are undone in the reverse order they were done.
+    // The edit is journaled in any case, as it wasn't yet when first pushed.
+    LayerTiles &tiles = grid->GetLayers()[_edited_layer_id].tiles;
+    UndoJournal &journal = _editor->_undo_journal;
+    QRect changed_area;
+    for(uint32_t i = 0; i < _deltas.size(); ++i) {
+        const TileDelta &delta = undo ? _deltas[_deltas.size() - 1 - i] : _deltas[i];
+        changed_area |= delta.Apply(tiles, undo);
+        journal.WriteDelta(_edited_layer_id, delta, undo);
     }
+    if(journal.IsCheckpointDue())
+        journal.WriteCheckpoint(grid->GetSnapshot(), grid->tileset_def_names);
 
-    _editor->_grid->UpdateScene();
+    if(changed_area.isEmpty())
+        return;
+
+    grid->_MarkTileDirty(changed_area.left(), changed_area.top());
+    grid->_MarkTileDirty(changed_area.right(), changed_area.bottom());
+    grid->UpdateDirtyTiles();
+    grid->SetChanged(true);
 }
 
-void LayerCommand::redo()
+int LayerCommand::id() const
 {
+    // Only paint and delete strokes are merged.
+    if(_tile_mode == PAINT_TILE || _tile_mode == DELETE_TILE)
+        return _tile_mode;
+    return -1;
+}
 
-    for(int32_t i = 0; i < static_cast<int32_t>(_tile_indeces.size()); i++) {
-        _editor->_grid->GetLayers()[_edited_layer_id].tiles[_tile_indeces[i].y()][_tile_indeces[i].x()] = _modified_tiles[i];
+bool LayerCommand::mergeWith(const QUndoCommand *command)
+{
+    // The ids match, so the command is a LayerCommand in the same mode.
+    const LayerCommand *next = static_cast<const LayerCommand *>(command);
+    if(next->_edited_layer_id != _edited_layer_id
+            || next->_start_time - _end_time > MERGE_DELAY)
+        return false;
+
+    _deltas.insert(_deltas.end(), next->_deltas.begin(), next->_deltas.end());
+    // Merge the last deltas until each one is less than half the one before it
+    while(_deltas.size() > 1 &&
+            _deltas.back().GetTileCount() * 2 >= _deltas[_deltas.size() - 2].GetTileCount()) {
+        TileDelta last = std::move(_deltas.back());
+        _deltas.pop_back();
+        _deltas.back().Merge(last);
     }
-    _editor->_grid->update();
+
+    // The next stroke is measured from the end of this one
+    _end_time = next->_end_time;
+    return true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// MapCommand class -- public functions
+///////////////////////////////////////////////////////////////////////////////
+
+MapCommand::MapCommand(GridSnapshot &&previous_map, GridSnapshot &&modified_map, Editor *editor,
+                       const QString &text, QUndoCommand *parent) :
+    QUndoCommand(text, parent),
+    _previous_map(std::move(previous_map)),
+    _modified_map(std::move(modified_map)),
+    _done(true),
+    _editor(editor)
+{}
+
+void MapCommand::undo()
+{
+    _Restore(_previous_map);
+    _done = false;
+}
+
+void MapCommand::redo()
+{
+    if(!_done)
+        _Restore(_modified_map);
+    else if(_editor->_grid)
+        _editor->_undo_journal.WriteCheckpoint(_modified_map, _editor->_grid->tileset_def_names);
+    _done = true;
+}
+
+void MapCommand::_Restore(const GridSnapshot &snapshot)
+{
+    Grid *grid = _editor->_grid;
+    if(!grid)
+        return;
+
+    uint32_t layer_id = grid->_layer_id;
+    grid->RestoreSnapshot(snapshot);
+    _editor->_undo_journal.WriteCheckpoint(snapshot, grid->tileset_def_names);
+
+    // Keep the selected layer when it still exists
+    _editor->_UpdateLayersView();
+    if(!snapshot.layers.empty())
+        _editor->_SetSelectedLayer(std::min<uint32_t>(layer_id, snapshot.layers.size() - 1));
+    grid->SetChanged(true);
 }
 
 } // namespace vt_editor
@@ -41,9 +41,13 @@
 #include <QToolBar>
 #include <QUndoCommand>
 
+#include "autotiling.h"
 #include "dialog_boxes.h"
 #include "grid.h"
+#include "tile_delta.h"
+#include "tileset_cache.h"
 #include "tileset_editor.h"
+#include "undo_journal.h"
 
 #include "script/script_read.h"
 
@@ -64,6 +68,7 @@ class Editor: public QMainWindow
     friend class MapPropertiesDialog;
     friend class LayerDialog;
     friend class LayerCommand;
+    friend class MapCommand;
 
 public:
     Editor();
@@ -172,6 +177,28 @@ private:
     // Clears and refill the layer view with the current layers found in the base context.
     void _UpdateLayersView();
 
+    //! \brief Points the autotiling table to the game autotiling file,
+    //! reloading it when it was modified. Called before painting tiles.
+    void _UpdateAutotiling();
+
+    //! \brief Creates a tileset table, using the tileset cache when possible.
+    //! \return The new tileset table, or nullptr if the tileset couldn't be loaded.
+    TilesetTable *_LoadTileset(const QString &def_filename);
+
+    //! \brief Pushes the undo command of a map structure change already done.
+    //! \param previous_map The map snapshot taken before the change.
+    void _PushMapCommand(GridSnapshot &&previous_map, const QString &text);
+
+    /** \brief Offers to restore the changes left in the undo journal of the
+    *** opened map, then starts a new journal for it.
+    **/
+    void _OpenUndoJournal();
+
+    /** \brief Replaces the map tilesets and their tabs with the given ones.
+    *** \return False if one of the tilesets couldn't be loaded. Nothing is changed then.
+    **/
+    bool _SetTilesets(const QStringList &tileset_names);
+
     //! \brief Used to determine if it is safe to erase the current map.
     //!        Will prompt the user for action: to save or not to save.
     //! \return True if user decided to save the map or intentionally erase it;
@@ -266,8 +293,17 @@ private:
     //! \brief The settings
     QSettings* _settings;
 
+    //! \brief The autotiling groups of the game, kept across maps.
+    AutotilingTable _autotiling;
+
+    //! \brief The loaded tilesets, shared by the successive maps.
+    TilesetCache _tileset_cache;
+
     //! \brief The stack that contains the undo and redo operations.
     QUndoStack* _undo_stack;
+
+    //! \brief Keeps the unsaved changes on disk, to restore them after a crash.
+    UndoJournal _undo_journal;
 }; // class Editor
 
 
@@ -278,27 +314,49 @@ class LayerCommand: public QUndoCommand
     friend class EditorScrollView;
 
 public:
-    LayerCommand(std::vector<QPoint> indeces, std::vector<int32_t> previous,
-                 std::vector<int32_t> modified, uint32_t layer_id, Editor *editor,
-                 const QString &text = "Layer Operation", QUndoCommand *parent = 0);
+    /** \param tile_mode The tile editing mode of the command. Successive paint
+    *** or delete commands done on the same layer in a short time are merged.
+    *** \param start_time When the edit started, in ms since epoch. The commands
+    *** are otherwise considered started when created.
+    **/
+    LayerCommand(TileDelta &&delta, uint32_t layer_id, Editor *editor,
+                 const QString &text = "Layer Operation", TILE_MODE_TYPE tile_mode = INVALID_TILE,
+                 qint64 start_time = -1, QUndoCommand *parent = 0);
 
     //! \name Undo Functions
     //! \brief Reimplemented from the QUndoCommand class to provide specific undo/redo capability towards the map.
     //{@
     void undo();
     void redo();
+    int id() const;
+    bool mergeWith(const QUndoCommand *command);
     //@}
 
 private:
-    //! \name Tile Vectors
-    //! \brief The following three vectors are used to know how to perform undo and redo operations
-    //!        for this command. They should be the same size and one-to-one. So, the j-th element
-    //!        of each vector should correspond to the j-th element of the other vectors.
-    //{@
-    std::vector<QPoint> _tile_indeces;  //! A vector of tile indeces in the map that were modified by this command.
-    std::vector<int32_t> _previous_tiles;//! A vector of indeces into tilesets of the modified tiles before they were modified.
-    std::vector<int32_t> _modified_tiles;//! A vector of indeces into tilesets of the modified tiles after they were modified.
-    //@}
+    //! \brief Applies the tile changes and redraws the tiles which changed.
+    void _Apply(bool undo);
+
+    /** \brief The tiles modified by this command, with their values before and after it.
+    ***
+    *** The changes of the merged strokes are kept in the order they were done.
+    *** Each delta holds less than half the tiles of the one before it, as the
+    *** last ones are merged together otherwise. A long series of strokes is
+    *** thus composed in O(n log n), and is applied through a few deltas only.
+    **/
+    std::vector<TileDelta> _deltas;
+
+    //! \brief The tile editing mode used, telling which commands can be merged.
+    TILE_MODE_TYPE _tile_mode;
+
+    //! \brief When the first stroke of the command started, in ms since epoch.
+    qint64 _start_time;
+
+    //! \brief When the last stroke merged in the command ended, in ms since epoch.
+    qint64 _end_time;
+
+    //! \brief The longest delay between the end of a stroke and the start
+    //! of the next one for both to be merged in one command, in ms.
+    static const qint64 MERGE_DELAY = 1500;
 
     //! Indicates which map layer this command was performed upon.
     uint32_t _edited_layer_id;
@@ -307,6 +365,43 @@ private:
     Editor *_editor;
 }; // class LayerCommand: public QUndoCommand
 
+
+/** ***************************************************************************
+*** \brief Undoes the changes of the map structure: rows, columns and layers.
+***
+*** The whole map is kept before and after the change. The snapshots share
+*** their tile chunks with the map, so that taking and restoring them only
+*** copies one pointer per chunk.
+*** **************************************************************************/
+class MapCommand: public QUndoCommand
+{
+public:
+    MapCommand(GridSnapshot &&previous_map, GridSnapshot &&modified_map, Editor *editor,
+               const QString &text = "Map Operation", QUndoCommand *parent = 0);
+
+    //! \name Undo Functions
+    //! \brief Reimplemented from the QUndoCommand class to provide specific undo/redo capability towards the map.
+    //{@
+    void undo();
+    void redo();
+    //@}
+
+private:
+    //! \brief Sets the map back to the given snapshot and refreshes the layer view.
+    void _Restore(const GridSnapshot &snapshot);
+
+    //! \brief The map before and after the change.
+    GridSnapshot _previous_map;
+    GridSnapshot _modified_map;
+
+    //! \brief The change is already done when the command is pushed,
+    //! so the first redo does nothing.
+    bool _done;
+
+    //! A reference to the main window so we can get the current map.
+    Editor *_editor;
+}; // class MapCommand: public QUndoCommand
+
 } // namespace vt_editor
 
 #endif
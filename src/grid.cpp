@@ -19,8 +19,8 @@
 #include "utils/utils_common.h"
 #include "grid.h"
 #include "editor.h"
+#include "map_writer.h"
 
-#include "script/script_write.h"
 #include "script/script_read.h"
 
 #include "utils/utils_random.h"
@@ -30,50 +30,34 @@
 #include <QGraphicsPixmapItem>
 #include <QGraphicsSceneMouseEvent>
 #include <QGraphicsSceneContextMenuEvent>
+#include <QStyleOptionGraphicsItem>
+#include <QPainter>
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QFile>
+#include <QSaveFile>
+#include <QSysInfo>
 
 #ifndef QT_NO_OPENGL
 #include <QOpenGLWidget>
 #endif
 
+#include <cmath>
+#include <limits>
+
 using namespace vt_script;
 
 namespace vt_editor
 {
 
-LAYER_TYPE getLayerType(const std::string &type)
-{
-    if(type == "ground")
-        return GROUND_LAYER;
-    else if(type == "sky")
-        return SKY_LAYER;
-
-    return INVALID_LAYER;
-
-}
-
-
-std::string getTypeFromLayer(const LAYER_TYPE &type)
-{
-
-    switch(type) {
-    case GROUND_LAYER:
-        return "ground";
-    case SKY_LAYER:
-        return "sky";
-    default:
-        break;
-    };
-    return "other";
-}
-
-
-
-LAYER_TYPE &operator++(LAYER_TYPE &value, int /*dummy*/)
-{
-    value = static_cast<LAYER_TYPE>(static_cast<int>(value) + 1);
-    return value;
-}
+//! \brief The map cache file header values. The version must be increased
+//! whenever the cache content changes.
+const quint32 MAP_CACHE_MAGIC = 0x56544d43; // "VTMC"
+const quint32 MAP_CACHE_VERSION = 1;
 
+//! \brief The QPixmapCache size needed by the layer chunks, in kilobytes.
+const int CHUNK_CACHE_LIMIT = 128 * 1024;
 
 Grid::Grid(QWidget *parent, const QString &name, uint32_t width, uint32_t height) :
     QGraphicsScene(),
@@ -84,23 +68,29 @@ Grid::Grid(QWidget *parent, const QString &name, uint32_t width, uint32_t height
     _changed(false),
     _initialized(false),
     _grid_on(true),
-    _select_on(false)
+    _select_on(false),
+    _selection_item(nullptr)
 {
     // Blue selection tile with 50% transparency
     _blue_square = QPixmap(32, 32);
     _blue_square.fill(QColor(0, 0, 255, 125));
 
     setSceneRect(0, 0, _width * TILE_WIDTH, _height * TILE_HEIGHT);
+    // The tiles are painted over it by the layer items
+    setBackgroundBrush(QBrush(Qt::black));
+
+    // Leaves room for the chunks of a few screens of layers.
+    QPixmapCache::setCacheLimit(std::max(QPixmapCache::cacheLimit(), CHUNK_CACHE_LIMIT));
+
+    // The layer items are created along with the layers, in UpdateScene().
+    _selection_item = new LayerItem(this, LayerItem::SELECTION_LAYER_ID);
+    _selection_item->setVisible(false);
+    addItem(_selection_item);
 
     // Initialize layers with -1 to indicate that no tile/object/etc. is
-    // present at this location
-    _select_layer.resize(_height);
-    for(uint32_t y = 0; y < _height; ++y) {
-        _select_layer[y].resize(_width);
-        for(uint32_t x = 0; x < _width; ++x) {
-            _select_layer[y][x] = -1;
-        }
-    }
+    // present at this location. The selection is mostly empty.
+    _select_layer.SetSparse(true);
+    _select_layer.Resize(_width, _height);
 
     // Create default base layers
     _tile_layers.resize(4);
@@ -113,29 +103,20 @@ Grid::Grid(QWidget *parent, const QString &name, uint32_t width, uint32_t height
     _tile_layers[2].name = tr("Background 3").toStdString();
     _tile_layers[3].layer_type = SKY_LAYER;
     _tile_layers[3].name = tr("Sky").toStdString();
+    // The sky is mostly empty
+    _tile_layers[3].tiles.SetSparse(true);
 
     // Set up its size, and fill it with empty values
-    _tile_layers[0].tiles.resize(_height);
-    _tile_layers[1].tiles.resize(_height);
-    _tile_layers[2].tiles.resize(_height);
-    _tile_layers[3].tiles.resize(_height);
-    for(uint32_t y = 0; y < _height; ++y) {
-        _tile_layers[0].tiles[y].resize(_width);
-        _tile_layers[1].tiles[y].resize(_width);
-        _tile_layers[2].tiles[y].resize(_width);
-        _tile_layers[3].tiles[y].resize(_width);
-        for(uint32_t x = 0; x < _width; ++x) {
-            _tile_layers[0].tiles[y][x] = -1;
-            _tile_layers[1].tiles[y][x] = -1;
-            _tile_layers[2].tiles[y][x] = -1;
-            _tile_layers[3].tiles[y][x] = -1;
-        }
+    for(uint32_t layer_id = 0; layer_id < _tile_layers.size(); ++layer_id) {
+        _tile_layers[layer_id].Resize(_width, _height);
+        _tile_layers[layer_id].Fill(-1);
     }
 
+    UpdateCollisionGrid();
+
     // Creates the graphic view
     _graphics_view = new QGraphicsView(parent);
     _graphics_view->setRenderHints(QPainter::Antialiasing);
-    _graphics_view->setBackgroundBrush(QBrush(Qt::black));
     _graphics_view->setScene(this);
 
     // Helps with rendering when not using OpenGL
@@ -151,6 +132,7 @@ Grid::Grid(QWidget *parent, const QString &name, uint32_t width, uint32_t height
     _tile_mode = PAINT_TILE;
     _layer_id = 0;
     _moving = false;
+    _stroke_start_time = 0;
 
     // Clear the undo/redo vectors.
     _tile_indeces.clear();
@@ -198,15 +180,36 @@ Grid::~Grid()
 
 void Grid::ClearSelectionLayer()
 {
-    for(uint32_t y = 0; y < _height; ++y) {
-        for(uint32_t x = 0; x < _width; ++x) {
-            _select_layer[y][x] = -1;
+    // Only check the chunks holding selected tiles
+    for(uint32_t chunk_y = 0; chunk_y < _select_layer.GetChunkRows(); ++chunk_y) {
+        for(uint32_t chunk_x = 0; chunk_x < _select_layer.GetChunkColumns(); ++chunk_x) {
+            if(_select_layer.IsChunkEmpty(chunk_x, chunk_y))
+                continue;
+
+            uint32_t right = std::min((chunk_x + 1) * LAYER_CHUNK_SIZE, _select_layer.GetWidth());
+            uint32_t bottom = std::min((chunk_y + 1) * LAYER_CHUNK_SIZE, _select_layer.GetHeight());
+            for(uint32_t y = chunk_y * LAYER_CHUNK_SIZE; y < bottom; ++y) {
+                for(uint32_t x = chunk_x * LAYER_CHUNK_SIZE; x < right; ++x) {
+                    if(_select_layer.GetTile(x, y) != -1)
+                        _MarkSelectionDirty(x, y);
+                }
+            }
         }
     }
+
+    // Gives the empty chunks back
+    _select_layer.Fill(-1);
+    UpdateDirtySelection();
 }
 
 bool Grid::LoadMap()
 {
+    // Skip the Lua parsing when an up to date cache exists
+    if(_LoadMapCache()) {
+        UpdateScene();
+        return true;
+    }
+
     // File descriptor for the map data that is to be read
     ReadScriptDescriptor read_data;
     // Used to read in vectors from the file
@@ -252,13 +255,8 @@ bool Grid::LoadMap()
     setSceneRect(0, 0, _width * TILE_WIDTH, _height * TILE_HEIGHT);
 
     // Create selection layer
-    _select_layer.resize(_height);
-    for(uint32_t y = 0; y < _height; ++y) {
-        _select_layer[y].resize(_width);
-        for(uint32_t x = 0; x < _width; ++x) {
-            _select_layer[y][x] = -1;
-        }
-    }
+    _select_layer.Resize(_width, _height);
+    _select_layer.Fill(-1);
 
     // Loads the tileset definition filenames
     tileset_def_names.clear();
@@ -310,6 +308,11 @@ bool Grid::LoadMap()
         // the layer visible name
         _tile_layers[layer_id].name = read_data.ReadString("name");
 
+        // Prepare the rows. The layer is read as a sparse one first,
+        // so that no memory is used for the empty areas.
+        _tile_layers[layer_id].tiles.SetSparse(true);
+        _tile_layers[layer_id].Resize(_width, _height);
+
         // Parse layers[layer_id].tiles[y]
         for(uint32_t y = 0; y < _height; ++y) {
             if(!read_data.DoesTableExist(y)) {
@@ -322,9 +325,6 @@ bool Grid::LoadMap()
 
             read_data.ReadIntVector(y, vect);
 
-            // Prepare the the row
-            _tile_layers[layer_id].tiles.resize(y + 1);
-
             if(vect.size() != _width) {
                 read_data.CloseFile();
                 QMessageBox::warning(_graphics_view, message_box_title,
@@ -333,11 +333,13 @@ bool Grid::LoadMap()
                 return false;
             }
 
-            for(std::vector<int32_t>::iterator it = vect.begin(); it != vect.end(); ++it)
-                _tile_layers[layer_id].tiles[y].push_back(*it);
+            _tile_layers[layer_id].tiles.SetRow(y, vect);
             vect.clear();
         } // iterate through the rows of the layer
 
+        // Only keep mostly empty layers sparse.
+        _tile_layers[layer_id].tiles.OptimizeStorage();
+
         // Closes layers[layer_id]
         read_data.CloseTable();
 
@@ -363,9 +365,9 @@ bool Grid::LoadMap()
 
 void Grid::SaveMap()
 {
-    WriteScriptDescriptor write_data;
+    MapWriter write_data;
 
-    if(!write_data.OpenFile(_file_name.toStdString())) {
+    if(!write_data.OpenFile(_file_name)) {
         QMessageBox::warning(_graphics_view, "Saving File...", QString("ERROR: could not open %1 for writing!").arg(_file_name));
         return;
     }
@@ -391,85 +393,32 @@ void Grid::SaveMap()
 
     write_data.WriteComment("The map grid to indicate walkability. 0 is walkable, 1 is not.");
     write_data.BeginTable("map_grid");
-    //[layer][walkability]
-    std::vector<std::vector<int32_t> > walk_vect;
-    // Used to save the northern walkability info of tiles in all layers of
-    // all contexts; initialize to walkable.
-    std::vector<int32_t> map_row_north(_width * 2, 0);
-    // Used to save the southern walkability info of tiles in all layers of
-    // all contexts; initialize to walkable.
-    std::vector<int32_t> map_row_south(_width * 2, 0);
 
-    for(uint32_t y = 0; y < _height; ++y) {
-        // Iterate through all layers, column by column, row by row.
-        for(uint32_t x = 0; x < _width; ++x) {
+    // The collision grid is kept up to date as the tiles change.
+    if(_collision_masks.size() != _width * _height)
+        UpdateCollisionGrid();
 
-            // Indicates whether a painted tile is present on at least one layer.
-            bool no_tile_at_all = true;
+    // Used to save the northern and southern walkability info of tiles
+    // in all layers.
+    std::vector<int32_t> map_row_north(_width * 2);
+    std::vector<int32_t> map_row_south(_width * 2);
 
-            // linearized coords
-            int32_t col = y * _width + x;
-
-            // Get walkability for each tile layers.
-            for(uint32_t layer_id = 0; layer_id < _tile_layers.size(); ++layer_id) {
-                // Don't deal with sky layers
-                if(_tile_layers[layer_id].layer_type == SKY_LAYER)
-                    continue;
-
-                int tileset_index = _tile_layers[layer_id].tiles[y][x] / 256;
-                int tile_index = -1;
-                if(tileset_index == 0) // First tileset
-                    tile_index = _tile_layers[layer_id].tiles[y][x];
-                else  // Don't divide by 0
-                    tile_index = _tile_layers[layer_id].tiles[y][x] %
-                                    (tileset_index * 256);
-
-                // Push back a layer
-                walk_vect.resize(layer_id + 1);
-
-                if(tile_index == -1) {
-                    // no tile on this layer we assume walkable (0) for now
-                    // until all layers have been checked.
-                    walk_vect[layer_id].push_back(0);
-                    walk_vect[layer_id].push_back(0);
-                    walk_vect[layer_id].push_back(0);
-                    walk_vect[layer_id].push_back(0);
-                } else {
-                    no_tile_at_all = false;
-                    walk_vect[layer_id] = tilesets[tileset_index]->walkability[tile_index];
-                }
-            } // For each layer
-
-            if(no_tile_at_all) {
-                // NW corner
-                map_row_north[col % _width * 2]     = 1;
-                // NE corner
-                map_row_north[col % _width * 2 + 1] = 1;
-                // SW corner
-                map_row_south[col % _width * 2]     = 1;
-                // SE corner
-                map_row_south[col % _width * 2 + 1] = 1;
-            }
-            else {
-                for(uint32_t i = 0; i < walk_vect.size(); ++i) {
-                    // NW corner
-                    map_row_north[col % _width * 2] |= walk_vect[i][0];
-                    // NE corner
-                    map_row_north[col % _width * 2 + 1] |= walk_vect[i][1];
-                    // SW corner
-                    map_row_south[col % _width * 2] |= walk_vect[i][2];
-                    // SE corner
-                    map_row_south[col % _width * 2 + 1] |= walk_vect[i][3];
-                }
-            } // a real tile exists at current location
-
-            walk_vect.clear();
+    for(uint32_t y = 0; y < _height; ++y) {
+        const uint8_t *cell_masks = &_collision_masks[y * _width];
+        for(uint32_t x = 0; x < _width; ++x) {
+            // Where there is no tile at all, nothing is walkable.
+            uint8_t mask = cell_masks[x];
+            if(!(mask & TILE_PRESENT_MASK))
+                mask = NW_CORNER_MASK | NE_CORNER_MASK | SW_CORNER_MASK | SE_CORNER_MASK;
+
+            map_row_north[x * 2]     = (mask & NW_CORNER_MASK) ? 1 : 0;
+            map_row_north[x * 2 + 1] = (mask & NE_CORNER_MASK) ? 1 : 0;
+            map_row_south[x * 2]     = (mask & SW_CORNER_MASK) ? 1 : 0;
+            map_row_south[x * 2 + 1] = (mask & SE_CORNER_MASK) ? 1 : 0;
         } // x
 
-        write_data.WriteIntVector(y * 2,   map_row_north);
-        write_data.WriteIntVector(y * 2 + 1, map_row_south);
-        map_row_north.assign(_width * 2, 0);
-        map_row_south.assign(_width * 2, 0);
+        write_data.WriteIntVector(y * 2, map_row_north.data(), _width * 2);
+        write_data.WriteIntVector(y * 2 + 1, map_row_south.data(), _width * 2);
     } // iterate through the rows (y axis) of the layers
 
     write_data.EndTable();
@@ -478,6 +427,7 @@ void Grid::SaveMap()
     write_data.WriteComment("The tile layers. The numbers are indeces to the tile_mappings table.");
     write_data.BeginTable("layers");
 
+    std::vector<int32_t> layer_row(_width);
     uint32_t layers_num = _tile_layers.size();
     for(uint32_t layer_id = 0; layer_id < layers_num; ++layer_id) {
 
@@ -486,14 +436,10 @@ void Grid::SaveMap()
         write_data.WriteString("type", getTypeFromLayer(_tile_layers[layer_id].layer_type));
         write_data.WriteString("name", _tile_layers[layer_id].name);
 
-        std::vector<int32_t> layer_row;
-
         for(uint32_t y = 0; y < _height; y++) {
-            for(uint32_t x = 0; x < _width; x++) {
-                layer_row.push_back(_tile_layers[layer_id].tiles[y][x]);
-            } // iterate through the columns of the lower layer
-            write_data.WriteIntVector(y, layer_row);
-            layer_row.clear();
+            // Empty chunks are copied as a whole
+            _tile_layers[layer_id].tiles.GetRow(y, layer_row.data());
+            write_data.WriteIntVector(y, layer_row.data(), _width);
         } // iterate through the rows of each layer
 
         write_data.EndTable(); // layer[layer_id]
@@ -503,12 +449,200 @@ void Grid::SaveMap()
 
     write_data.EndTable(); // map_data
 
-    write_data.CloseFile();
+    if(!write_data.CloseFile()) {
+        QMessageBox::warning(_graphics_view, "Saving File...", QString("ERROR: could not write %1!").arg(_file_name));
+        return;
+    }
+
+    _SaveMapCache();
 
     _changed = false;
 } // Grid::SaveMap()
 
-std::vector<std::vector<int32_t> >& Grid::GetCurrentLayer()
+void Grid::UpdateCollisionGrid()
+{
+    // Index 0 stands for the empty tile (-1).
+    _tile_masks.assign(tilesets.size() * 256 + 1, 0);
+    for(uint32_t tileset_index = 0; tileset_index < tilesets.size(); ++tileset_index) {
+        const uint8_t *masks = tilesets[tileset_index]->GetWalkabilityMasks();
+        for(uint32_t i = 0; i < 256; ++i)
+            _tile_masks[tileset_index * 256 + i + 1] = masks[i] | TILE_PRESENT_MASK;
+    }
+
+    _collision_masks.assign(_width * _height, 0);
+
+    std::vector<int32_t> layer_row(_width);
+    for(uint32_t layer_id = 0; layer_id < _tile_layers.size(); ++layer_id) {
+        // Sky layers don't block the way
+        if(_tile_layers[layer_id].layer_type == SKY_LAYER)
+            continue;
+
+        for(uint32_t y = 0; y < _height; ++y) {
+            _tile_layers[layer_id].tiles.GetRow(y, layer_row.data());
+            _OrTileMasks(layer_row.data(), &_collision_masks[y * _width], _width);
+        }
+    }
+}
+
+void Grid::_OrTileMasks(const int32_t *tiles, uint8_t *cell_masks, uint32_t count) const
+{
+    const uint8_t *masks = _tile_masks.data();
+    uint32_t masks_size = _tile_masks.size();
+    for(uint32_t x = 0; x < count; ++x) {
+        uint32_t index = static_cast<uint32_t>(tiles[x] + 1);
+        cell_masks[x] |= index < masks_size ? masks[index] : TILE_PRESENT_MASK;
+    }
+}
+
+void Grid::_UpdateCollisionMasks(const QRect &area)
+{
+    // Wait for the next full update when the map size changed
+    if(_collision_masks.size() != _width * _height)
+        return;
+
+    QRect cells = area & QRect(0, 0, _width, _height);
+    if(cells.isEmpty())
+        return;
+
+    for(int32_t y = cells.top(); y <= cells.bottom(); ++y) {
+        for(int32_t x = cells.left(); x <= cells.right(); ++x) {
+            uint8_t mask = 0;
+            for(uint32_t layer_id = 0; layer_id < _tile_layers.size(); ++layer_id) {
+                if(_tile_layers[layer_id].layer_type != SKY_LAYER)
+                    mask |= _GetTileMask(_tile_layers[layer_id].tiles.GetTile(x, y));
+            }
+            _collision_masks[y * _width + x] = mask;
+        }
+    }
+}
+
+QString Grid::_GetMapCacheFilename() const
+{
+    return _file_name + ".cache";
+}
+
+bool Grid::_LoadMapCache()
+{
+    // The cache is only valid for the exact Lua file content it was made from
+    QFile lua_file(_file_name);
+    QFile cache_file(_GetMapCacheFilename());
+    if(!lua_file.open(QIODevice::ReadOnly) || !cache_file.open(QIODevice::ReadOnly))
+        return false;
+    QByteArray lua_hash = QCryptographicHash::hash(lua_file.readAll(), QCryptographicHash::Sha1);
+    lua_file.close();
+
+    QDataStream stream(&cache_file);
+    stream.setVersion(QDataStream::Qt_5_0);
+
+    quint32 magic = 0;
+    quint32 version = 0;
+    qint32 byte_order = -1;
+    QByteArray hash;
+    stream >> magic >> version >> byte_order >> hash;
+    // The tile rows are stored as they are in memory
+    if(magic != MAP_CACHE_MAGIC || version != MAP_CACHE_VERSION ||
+            byte_order != QSysInfo::ByteOrder || hash != lua_hash)
+        return false;
+
+    quint32 width = 0;
+    quint32 height = 0;
+    QStringList tileset_names;
+    quint32 layers_num = 0;
+    stream >> width >> height >> tileset_names >> layers_num;
+    if(stream.status() != QDataStream::Ok || width == 0 || height == 0 ||
+            width > static_cast<quint32>(std::numeric_limits<int>::max()) / sizeof(int32_t))
+        return false;
+
+    // The tiles of all the layers must be found in the rest of the file.
+    // This checks the sizes before allocating anything.
+    quint64 tiles_size = static_cast<quint64>(width) * height * sizeof(int32_t);
+    quint64 bytes_left = static_cast<quint64>(cache_file.size() - cache_file.pos());
+    if(tiles_size > bytes_left || layers_num > bytes_left / tiles_size)
+        return false;
+
+    // Read everything before touching the current map data
+    std::vector<Layer> layers(layers_num);
+    std::vector<int32_t> row(width);
+    const int row_bytes = static_cast<int>(width * sizeof(int32_t));
+    for(uint32_t layer_id = 0; layer_id < layers_num; ++layer_id) {
+        qint32 layer_type = INVALID_LAYER;
+        QString name;
+        stream >> layer_type >> name;
+        if(stream.status() != QDataStream::Ok || (layer_type != GROUND_LAYER && layer_type != SKY_LAYER))
+            return false;
+
+        Layer &layer = layers[layer_id];
+        layer.layer_type = static_cast<LAYER_TYPE>(layer_type);
+        layer.name = name.toStdString();
+        layer.tiles.SetSparse(true);
+        layer.Resize(width, height);
+
+        for(uint32_t y = 0; y < height; ++y) {
+            if(stream.readRawData(reinterpret_cast<char *>(row.data()), row_bytes) != row_bytes)
+                return false;
+            layer.tiles.SetRow(y, row);
+        }
+
+        // Only keep mostly empty layers sparse.
+        layer.tiles.OptimizeStorage();
+    }
+
+    if(stream.status() != QDataStream::Ok)
+        return false;
+
+    tilesets.clear();
+    tileset_def_names = tileset_names;
+    _tile_layers.swap(layers);
+    _width = width;
+    _height = height;
+
+    setSceneRect(0, 0, _width * TILE_WIDTH, _height * TILE_HEIGHT);
+    _select_layer.Resize(_width, _height);
+    _select_layer.Fill(-1);
+
+    return true;
+} // Grid::_LoadMapCache()
+
+void Grid::_SaveMapCache()
+{
+    QFile lua_file(_file_name);
+    if(!lua_file.open(QIODevice::ReadOnly))
+        return;
+    QByteArray lua_hash = QCryptographicHash::hash(lua_file.readAll(), QCryptographicHash::Sha1);
+    lua_file.close();
+
+    // The previous cache is only replaced once the new one is complete
+    QSaveFile cache_file(_GetMapCacheFilename());
+    if(!cache_file.open(QIODevice::WriteOnly)) {
+        QFile::remove(_GetMapCacheFilename());
+        return;
+    }
+
+    QDataStream stream(&cache_file);
+    stream.setVersion(QDataStream::Qt_5_0);
+
+    stream << MAP_CACHE_MAGIC << MAP_CACHE_VERSION << static_cast<qint32>(QSysInfo::ByteOrder) << lua_hash;
+    stream << static_cast<quint32>(_width) << static_cast<quint32>(_height) << tileset_def_names
+           << static_cast<quint32>(_tile_layers.size());
+
+    std::vector<int32_t> row(_width);
+    for(uint32_t layer_id = 0; layer_id < _tile_layers.size(); ++layer_id) {
+        stream << static_cast<qint32>(_tile_layers[layer_id].layer_type)
+               << QString::fromStdString(_tile_layers[layer_id].name);
+
+        for(uint32_t y = 0; y < _height; ++y) {
+            _tile_layers[layer_id].tiles.GetRow(y, row);
+            stream.writeRawData(reinterpret_cast<const char *>(row.data()),
+                                static_cast<int>(_width * sizeof(int32_t)));
+        }
+    }
+
+    // A stale cache would be ignored anyway, but don't keep it around
+    if(stream.status() != QDataStream::Ok || !cache_file.commit())
+        QFile::remove(_GetMapCacheFilename());
+} // Grid::_SaveMapCache()
+
+LayerTiles& Grid::GetCurrentLayer()
 {
     return GetLayers()[_layer_id].tiles;
 }
@@ -540,6 +674,7 @@ void Grid::AddLayer(const LayerInfo &layer_info)
     Layer layer;
     layer.layer_type = layer_info.layer_type;
     layer.name = layer_info.name;
+    layer.tiles.SetSparse(layer_info.sparse);
     layer.Resize(_width, _height);
     layer.Fill(-1); // Make the layer empty
 
@@ -547,6 +682,9 @@ void Grid::AddLayer(const LayerInfo &layer_info)
     if(new_layer_id >= _tile_layers.size()) {
         assert(new_layer_id == _tile_layers.size());
         _tile_layers.push_back(layer);
+
+        // Creates the layer item of the new layer
+        UpdateScene();
         return;
     }
 
@@ -584,142 +722,129 @@ void Grid::DeleteLayer(uint32_t layer_id)
         ++layer;
     }
 
+    UpdateCollisionGrid();
     UpdateScene();
 }
 
-void Grid::InsertRow(uint32_t tile_index_y)
+void Grid::SetLayerVisible(uint32_t layer_id, bool visible)
 {
-    // Check that tile_index is within acceptable bounds
-    if (tile_index_y >= _height)
+    if(layer_id >= _tile_layers.size())
         return;
 
-    // Prepare an empty row (filled with -1.)
-    std::vector<int32_t> row;
-    row.resize(_width, -1);
+    _tile_layers[layer_id].visible = visible;
+    if(layer_id < _layer_items.size())
+        _layer_items[layer_id]->setVisible(visible);
+}
+
+void Grid::SwapLayers(uint32_t first_layer_id, uint32_t second_layer_id)
+{
+    if(first_layer_id >= _tile_layers.size() || second_layer_id >= _tile_layers.size())
+        return;
+
+    std::swap(_tile_layers[first_layer_id], _tile_layers[second_layer_id]);
+
+    // The items keep drawing the same tiles, only their stacking changes.
+    if(first_layer_id < _layer_items.size() && second_layer_id < _layer_items.size()) {
+        std::swap(_layer_items[first_layer_id], _layer_items[second_layer_id]);
+        _layer_items[first_layer_id]->SetLayerId(first_layer_id);
+        _layer_items[second_layer_id]->SetLayerId(second_layer_id);
+    }
+}
+
+GridSnapshot Grid::GetSnapshot() const
+{
+    GridSnapshot snapshot;
+    snapshot.width = _width;
+    snapshot.height = _height;
+    snapshot.layers = _tile_layers;
+    return snapshot;
+}
+
+void Grid::RestoreSnapshot(const GridSnapshot &snapshot)
+{
+    _tile_layers = snapshot.layers;
+    if(!_tile_layers.empty() && _layer_id >= _tile_layers.size())
+        _layer_id = _tile_layers.size() - 1;
+
+    // Updates the selection layer, the collision grid and the layer items.
+    Resize(snapshot.width, snapshot.height);
+}
+
+bool Grid::InsertRow(uint32_t tile_index_y)
+{
+    // Check that tile_index is within acceptable bounds
+    if (tile_index_y >= _height)
+        return false;
 
     std::vector<Layer>::iterator it = _tile_layers.begin();
     std::vector<Layer>::iterator it_end = _tile_layers.end();
-    for(; it != it_end; ++it) {
-        Layer& layer = (*it);
-
-        // We do it naively so it's more portable...
-        std::vector< std::vector<int32_t> >::iterator tile_y_it = layer.tiles.begin();
-        uint32_t y = 0; // the row index
-        for (; tile_y_it != layer.tiles.end(); ++tile_y_it) {
-            // If the wanted index is found we can delete and break.
-            if (y == tile_index_y) {
-                layer.tiles.insert(tile_y_it, row);
-                break;
-            }
-            ++y;
-        }
-    }
+    for(; it != it_end; ++it)
+        it->tiles.InsertRow(tile_index_y);
 
     // Updates every related map members.
     Resize(_width, _height + 1);
+    return true;
 } // Grid::InsertRow(...)
 
 
-void Grid::InsertCol(uint32_t tile_index_x)
+bool Grid::InsertCol(uint32_t tile_index_x)
 {
     // Check that tile_index is within acceptable bounds
     if (tile_index_x >= _width)
-        return;
-
+        return false;
 
     std::vector<Layer>::iterator it = _tile_layers.begin();
     std::vector<Layer>::iterator it_end = _tile_layers.end();
-    for(; it != it_end; ++it) {
-        Layer& layer = (*it);
-
-        // We do it naively so it's more portable...
-        for (uint32_t y = 0; y < layer.tiles.size(); ++y) {
-            std::vector<int32_t>::iterator tile_x_it = layer.tiles[y].begin();
-            uint32_t x = 0; // the column index
-            for (; tile_x_it != layer.tiles[y].end(); ++tile_x_it) {
-                // If the wanted index is found we can delete and break.
-                if (x == tile_index_x) {
-                    layer.tiles[y].insert(tile_x_it, -1); // Insert an empty tile.
-                    break;
-                }
-                ++x;
-            }
-        } // for each rows
-    }
+    for(; it != it_end; ++it)
+        it->tiles.InsertCol(tile_index_x);
 
     // Updates every related map members.
     Resize(_width + 1, _height);
+    return true;
 } // Grid::InsertCol(...)
 
 
-void Grid::DeleteRow(uint32_t tile_index_y)
+bool Grid::DeleteRow(uint32_t tile_index_y)
 {
     // Check that tile_index is within acceptable bounds
     if (tile_index_y >= _height)
-        return;
+        return false;
 
     // Check that deleting this row does not cause map height to fall below
     // minimum allowed value
     if (_height - 1 < map_min_height)
-        return;
+        return false;
 
     std::vector<Layer>::iterator it = _tile_layers.begin();
     std::vector<Layer>::iterator it_end = _tile_layers.end();
-    for(; it != it_end; ++it) {
-        Layer& layer = (*it);
-
-        // We do it naively so it's more portable...
-        std::vector< std::vector<int32_t> >::iterator tile_y_it = layer.tiles.begin();
-        uint32_t y = 0; // the row index
-        for (; tile_y_it != layer.tiles.end(); ++tile_y_it) {
-            // If the wanted index is found we can delete and break.
-            if (y == tile_index_y) {
-                layer.tiles.erase(tile_y_it);
-                break;
-            }
-            ++y;
-        }
-    }
+    for(; it != it_end; ++it)
+        it->tiles.DeleteRow(tile_index_y);
 
     // Updates every related map members.
     Resize(_width, _height - 1);
-
+    return true;
 } // Grid::DeleteRow(...)
 
 
-void Grid::DeleteCol(uint32_t tile_index_x)
+bool Grid::DeleteCol(uint32_t tile_index_x)
 {
     // Check that tile_index is within acceptable bounds
     if (tile_index_x >= _width)
-        return;
+        return false;
 
     // Check that deleting this column does not cause map width to fall below
     // minimum allowed value
     if (_width - 1 < map_min_width)
-        return;
+        return false;
 
     std::vector<Layer>::iterator it = _tile_layers.begin();
     std::vector<Layer>::iterator it_end = _tile_layers.end();
-    for(; it != it_end; ++it) {
-        Layer& layer = (*it);
-
-        // We do it naively so it's more portable...
-        for (uint32_t y = 0; y < layer.tiles.size(); ++y) {
-            std::vector<int32_t>::iterator tile_x_it = layer.tiles[y].begin();
-            uint32_t x = 0; // the column index
-            for (; tile_x_it != layer.tiles[y].end(); ++tile_x_it) {
-                // If the wanted index is found we can delete and break.
-                if (x == tile_index_x) {
-                    layer.tiles[y].erase(tile_x_it);
-                    break;
-                }
-                ++x;
-            }
-        } // for each rows
-    }
+    for(; it != it_end; ++it)
+        it->tiles.DeleteCol(tile_index_x);
 
     // Updates every related map members.
     Resize(_width - 1, _height);
+    return true;
 } // Grid::DeleteCol(...)
 
 std::vector<QTreeWidgetItem *> Grid::getLayerItems()
@@ -755,74 +880,201 @@ void Grid::UpdateScene()
     if(_initialized == false)
         return;
 
+    // The whole scene is refreshed, so nothing is left to patch.
+    _UpdateCollisionMasks(_dirty_tiles);
+    _dirty_tiles = QRect();
+
     // Setup drawing parameters
-    clear();
     setSceneRect(0, 0, _width * TILE_WIDTH, _height * TILE_HEIGHT);
-    setBackgroundBrush(QBrush(Qt::gray));
 
-    // Start drawing from the top left
-    for (uint32_t x = 0; x < _width; ++x) {
-        for (uint32_t y = 0; y < _height; ++y) {
-            for(uint32_t layer_id = 0; layer_id < _tile_layers.size(); ++layer_id) {
-                // Don't draw the layer if it's not visible
-                if(!_tile_layers[layer_id].visible)
-                    continue;
-
-                 int32_t layer_index = _tile_layers[layer_id].tiles[y][x];
-                 // Draw tile if one exists at this location
-                 if(layer_index == -1)
-                     continue;
-
-                int32_t tileset_index = layer_index / 256;
-                if (tileset_index >= static_cast<int32_t>(tilesets.size())) {
-                    std::cout << "Error: Invalid tileset index: " << tileset_index << " / "
-                              << tilesets.size() << std::endl;
-                    continue;
-                }
+    _UpdateLayerItems();
+    for(uint32_t layer_id = 0; layer_id < _layer_items.size(); ++layer_id)
+        _layer_items[layer_id]->InvalidateAll();
 
-                // Don't divide by zero
-                int32_t tile_index = 0;
-                if(tileset_index == 0)
-                    tile_index = layer_index;
-                else
-                    tile_index = layer_index % (tileset_index * 256);
+    // The tiles are painted by the layer items and the grid in drawForeground()
+    update(sceneRect());
 
-                addPixmap(tilesets[tileset_index]->tiles[tile_index])->setPos(x * TILE_WIDTH, y * TILE_HEIGHT);
-            }
+} // void Grid::UpdateScene()
 
-            // Draw the selection square
-            if(!_select_on)
-                continue;
+void Grid::UpdateDirtyTiles()
+{
+    // Only keep what is still part of the map
+    QRect dirty = _dirty_tiles & QRect(0, 0, _width, _height);
+    _dirty_tiles = QRect();
+
+    _UpdateCollisionMasks(dirty);
+
+    if(_initialized == false || dirty.isEmpty())
+        return;
+
+    // Any layer may have changed there
+    for(uint32_t layer_id = 0; layer_id < _layer_items.size(); ++layer_id)
+        _layer_items[layer_id]->InvalidateTiles(dirty);
+
+    update(QRectF(dirty.x() * TILE_WIDTH, dirty.y() * TILE_HEIGHT,
+                  dirty.width() * TILE_WIDTH, dirty.height() * TILE_HEIGHT));
+} // void Grid::UpdateDirtyTiles()
+
+void Grid::UpdateDirtySelection()
+{
+    QRect dirty = _dirty_selection & QRect(0, 0, _width, _height);
+    _dirty_selection = QRect();
+
+    if(_initialized == false || dirty.isEmpty())
+        return;
+
+    // The selection squares aren't cached, only their item needs a repaint
+    _selection_item->update(QRectF(dirty.x() * TILE_WIDTH, dirty.y() * TILE_HEIGHT,
+                                   dirty.width() * TILE_WIDTH, dirty.height() * TILE_HEIGHT));
+} // void Grid::UpdateDirtySelection()
+
+void Grid::_MarkTileDirty(int32_t x, int32_t y)
+{
+    _dirty_tiles |= QRect(x, y, 1, 1);
+}
+
+void Grid::_MarkSelectionDirty(int32_t x, int32_t y)
+{
+    _dirty_selection |= QRect(x, y, 1, 1);
+}
 
-            int32_t select_layer_index = _select_layer[y][x];
-            if(select_layer_index == -1)
+void Grid::_UpdateLayerItems()
+{
+    while(_layer_items.size() < _tile_layers.size()) {
+        LayerItem *item = new LayerItem(this, _layer_items.size());
+        addItem(item);
+        _layer_items.push_back(item);
+    }
+    while(_layer_items.size() > _tile_layers.size()) {
+        // Also removes it from the scene
+        delete _layer_items.back();
+        _layer_items.pop_back();
+    }
+
+    for(uint32_t layer_id = 0; layer_id < _layer_items.size(); ++layer_id) {
+        _layer_items[layer_id]->SetMapSize(_width, _height);
+        _layer_items[layer_id]->setVisible(_tile_layers[layer_id].visible);
+    }
+
+    _selection_item->SetMapSize(_width, _height);
+    _selection_item->setVisible(_select_on);
+}
+
+bool Grid::_GetTileArea(const QRectF &rect, QRect &tile_area) const
+{
+    if(_initialized == false || _width == 0 || _height == 0)
+        return false;
+
+    int32_t left = std::max(0, static_cast<int32_t>(std::floor(rect.left() / TILE_WIDTH)));
+    int32_t top = std::max(0, static_cast<int32_t>(std::floor(rect.top() / TILE_HEIGHT)));
+    int32_t right = std::min(static_cast<int32_t>(_width) - 1,
+                             static_cast<int32_t>(std::floor(rect.right() / TILE_WIDTH)));
+    int32_t bottom = std::min(static_cast<int32_t>(_height) - 1,
+                              static_cast<int32_t>(std::floor(rect.bottom() / TILE_HEIGHT)));
+    if(left > right || top > bottom)
+        return false;
+
+    tile_area.setCoords(left, top, right, bottom);
+    return true;
+}
+
+void Grid::_DrawLayerTiles(QPainter *painter, const LayerTiles &tiles,
+                           int32_t left, int32_t top, int32_t right, int32_t bottom,
+                           bool selection)
+{
+    // The layers are walked chunk by chunk, so that empty ones are skipped.
+    const int32_t chunk_width = LAYER_CHUNK_SIZE;
+    const int32_t chunk_height = LAYER_CHUNK_SIZE;
+
+    for(int32_t chunk_y = top / chunk_height; chunk_y <= bottom / chunk_height; ++chunk_y) {
+        for(int32_t chunk_x = left / chunk_width; chunk_x <= right / chunk_width; ++chunk_x) {
+            if(tiles.IsChunkEmpty(chunk_x, chunk_y))
                 continue;
-            addPixmap(_blue_square)->setPos(x * TILE_WIDTH, y * TILE_HEIGHT);
+
+            int32_t first_y = std::max(top, chunk_y * chunk_height);
+            int32_t last_y = std::min(bottom, (chunk_y + 1) * chunk_height - 1);
+            int32_t first_x = std::max(left, chunk_x * chunk_width);
+            int32_t last_x = std::min(right, (chunk_x + 1) * chunk_width - 1);
+
+            for(int32_t y = first_y; y <= last_y; ++y) {
+                for(int32_t x = first_x; x <= last_x; ++x) {
+                    int32_t layer_index = tiles.GetTile(x, y);
+                    // Draw tile if one exists at this location
+                    if(layer_index == -1)
+                        continue;
+
+                    // The selection layer shows the selection square
+                    if(selection) {
+                        painter->drawPixmap(x * TILE_WIDTH, y * TILE_HEIGHT, _blue_square);
+                        continue;
+                    }
+
+                    int32_t tileset_index = layer_index / 256;
+                    if (tileset_index >= static_cast<int32_t>(tilesets.size())) {
+                        std::cout << "Error: Invalid tileset index: " << tileset_index << " / "
+                                  << tilesets.size() << std::endl;
+                        continue;
+                    }
+
+                    // Don't divide by zero
+                    int32_t tile_index = 0;
+                    if(tileset_index == 0)
+                        tile_index = layer_index;
+                    else
+                        tile_index = layer_index % (tileset_index * 256);
+
+                    painter->drawPixmap(QPoint(x * TILE_WIDTH, y * TILE_HEIGHT), tilesets[tileset_index]->atlas,
+                                        Tileset::GetTileRect(tile_index));
+                }
+            }
         }
     }
+}
+
+void Grid::drawForeground(QPainter *painter, const QRectF &rect)
+{
+    if(_initialized == false || _width == 0 || _height == 0)
+        return;
 
-    // If grid is toggled on, draw it
     if(_grid_on)
-        _DrawGrid();
+        _DrawGrid(painter, rect);
 
     // Draw the borders of the map.
-    QPen pen;
-    pen.setColor(Qt::red);
-    addLine(0, 0, _width * TILE_WIDTH, 0, pen);
-    addLine(0, _height * TILE_HEIGHT, _width * TILE_WIDTH, _height * TILE_HEIGHT, pen);
-    addLine(0, 0, 0, _height * TILE_HEIGHT, pen);
-    addLine(_width * TILE_WIDTH, 0, _width * TILE_WIDTH, _height * TILE_HEIGHT, pen);
-
-} // void Grid::UpdateScene()
+    painter->setPen(QPen(Qt::red));
+    painter->setBrush(Qt::NoBrush);
+    painter->drawRect(QRectF(0, 0, _width * TILE_WIDTH, _height * TILE_HEIGHT));
+}
 
-void Grid::_DrawGrid()
+void Grid::_DrawGrid(QPainter *painter, const QRectF &rect)
 {
-    for (uint32_t y = 0; y < (_height * TILE_HEIGHT); y+=32) {
-        for (uint32_t x = 0; x < (_width * TILE_WIDTH); x+=32) {
-            addLine(0, y, _width * TILE_WIDTH, y, QPen(Qt::DotLine));
-            addLine(x, 0, x, _height * TILE_HEIGHT, QPen(Qt::DotLine));
-        }
-    }
+    // Only the lines crossing the exposed rectangle are drawn, and the lines
+    // are cut to the exposed part of the map.
+    int32_t left = std::max(0, static_cast<int32_t>(std::floor(rect.left() / TILE_WIDTH)));
+    int32_t top = std::max(0, static_cast<int32_t>(std::floor(rect.top() / TILE_HEIGHT)));
+    int32_t right = std::min(static_cast<int32_t>(_width),
+                             static_cast<int32_t>(std::ceil(rect.right() / TILE_WIDTH)));
+    int32_t bottom = std::min(static_cast<int32_t>(_height),
+                              static_cast<int32_t>(std::ceil(rect.bottom() / TILE_HEIGHT)));
+    if(left >= right || top >= bottom)
+        return;
+
+    // The map borders are already drawn, so the lines start past them.
+    QVector<QLineF> vertical_lines;
+    for(int32_t x = std::max(left, 1); x <= right && x < static_cast<int32_t>(_width); ++x)
+        vertical_lines.append(QLineF(x * TILE_WIDTH, top * TILE_HEIGHT, x * TILE_WIDTH, bottom * TILE_HEIGHT));
+    QVector<QLineF> horizontal_lines;
+    for(int32_t y = std::max(top, 1); y <= bottom && y < static_cast<int32_t>(_height); ++y)
+        horizontal_lines.append(QLineF(left * TILE_WIDTH, y * TILE_HEIGHT, right * TILE_WIDTH, y * TILE_HEIGHT));
+
+    // The dash offset keeps the dots in place whatever part of the line is drawn.
+    QPen pen(Qt::DotLine);
+    pen.setDashOffset(top * TILE_HEIGHT);
+    painter->setPen(pen);
+    painter->drawLines(vertical_lines);
+
+    pen.setDashOffset(left * TILE_WIDTH);
+    painter->setPen(pen);
+    painter->drawLines(horizontal_lines);
 }
 
 void Grid::Resize(int w, int h)
@@ -830,6 +1082,9 @@ void Grid::Resize(int w, int h)
     setSceneRect(0, 0, w, h);
     _width = w;
     _height = h;
+    // Keep the selection layer in sync with the map size.
+    _select_layer.Resize(_width, _height);
+    UpdateCollisionGrid();
     _changed = true;
     UpdateScene();
 } // Grid::Resize(...)
@@ -850,6 +1105,7 @@ void Grid::mousePressEvent(QGraphicsSceneMouseEvent *evt)
         return;
 
     SetChanged(true);
+    _stroke_start_time = QDateTime::currentMSecsSinceEpoch();
 
     // record location of pressed tile
     _tile_index_x = x / TILE_WIDTH;
@@ -861,14 +1117,19 @@ void Grid::mousePressEvent(QGraphicsSceneMouseEvent *evt)
         _first_corner_index_x = _tile_index_x;
         _first_corner_index_y = _tile_index_y;
         GetSelectionLayer()[_tile_index_y][_tile_index_x] = 1;
+        _MarkSelectionDirty(_tile_index_x, _tile_index_y);
+        UpdateDirtySelection();
     } // selection mode is on
 
 
     switch(_tile_mode) {
     case PAINT_TILE: { // start painting tiles
+        // Takes in account the changes done to the autotiling file
+        editor->_UpdateAutotiling();
+
         if(evt->button() == Qt::LeftButton && editor->_select_on == false) {
             _PaintTile(_tile_index_x, _tile_index_y);
-            UpdateScene();
+            UpdateDirtyTiles();
         }
         break;
     } // edit mode PAINT_TILE
@@ -885,7 +1146,7 @@ void Grid::mousePressEvent(QGraphicsSceneMouseEvent *evt)
     case DELETE_TILE: { // start deleting tiles
         if(evt->button() == Qt::LeftButton && editor->_select_on == false) {
             _DeleteTile(_tile_index_x, _tile_index_y);
-            UpdateScene();
+            UpdateDirtyTiles();
         }
         break;
     } // edit mode DELETE_TILE
@@ -945,27 +1206,29 @@ void Grid::mouseMoveEvent(QGraphicsSceneMouseEvent *evt)
             for(int y = y_old; y <= y_new; y++)
                 for(int x = x_old; x <= x_new; x++)
                     GetSelectionLayer()[y][x] = 1;
+            _dirty_selection |= QRect(QPoint(x_old, y_old), QPoint(x_new, y_new));
+            UpdateDirtySelection();
         } // left mouse button was pressed and selection mode is on
 
         switch(_tile_mode) {
         case PAINT_TILE: { // continue painting tiles
             if(evt->buttons() == Qt::LeftButton && editor->_select_on == false) {
                 _PaintTile(_tile_index_x, _tile_index_y);
-                UpdateScene();
+                UpdateDirtyTiles();
             }
             break;
         } // edit mode PAINT_TILE
 
         case MOVE_TILE: { // continue moving a tile
             if (_moving)
-                UpdateScene();
+                UpdateDirtyTiles();
             break;
         } // edit mode MOVE_TILE
 
         case DELETE_TILE: { // continue deleting tiles
             if(evt->buttons() == Qt::LeftButton && editor->_select_on == false) {
                 _DeleteTile(_tile_index_x, _tile_index_y);
-                UpdateScene();
+                UpdateDirtyTiles();
             }
             break;
         } // edit mode DELETE_TILE
@@ -1002,21 +1265,21 @@ void Grid::mouseReleaseEvent(QGraphicsSceneMouseEvent *evt)
     switch(_tile_mode) {
     case PAINT_TILE: { // wrap up painting tiles
         if(editor->_select_on == true) {
-            std::vector<std::vector<int32_t> > select_layer = GetSelectionLayer();
-            for(int32_t y = 0; y < static_cast<int32_t>(select_layer.size()); ++y) {
-                for(int32_t x = 0; x < static_cast<int32_t>(select_layer[y].size()); ++x) {
+            const LayerTiles& select_layer = GetSelectionLayer();
+            for(int32_t y = 0; y < static_cast<int32_t>(select_layer.GetHeight()); ++y) {
+                for(int32_t x = 0; x < static_cast<int32_t>(select_layer.GetWidth()); ++x) {
                     // Works because the selection layer and the current layer
                     // have the same size.
                     if(select_layer[y][x] != -1)
                         _PaintTile(x, y);
                 } // x
             } // y
-            UpdateScene();
+            UpdateDirtyTiles();
         } // only if painting a bunch of tiles
 
         // Push command onto the undo stack.
-        LayerCommand *paint_command = new LayerCommand(_tile_indeces,
-                _previous_tiles, _modified_tiles, _layer_id, editor, "Paint");
+        LayerCommand *paint_command = new LayerCommand(TileDelta(_tile_indeces,
+                _previous_tiles, _modified_tiles), _layer_id, editor, "Paint", PAINT_TILE, _stroke_start_time);
         editor->_undo_stack->push(paint_command);
         _tile_indeces.clear();
         _previous_tiles.clear();
@@ -1029,25 +1292,27 @@ void Grid::mouseReleaseEvent(QGraphicsSceneMouseEvent *evt)
             // record location of released tile
             _tile_index_x = mouse_x / TILE_WIDTH;
             _tile_index_y = mouse_y / TILE_HEIGHT;
-            std::vector<std::vector<int32_t> >& layer = GetCurrentLayer();
+            LayerTiles& layer = GetCurrentLayer();
 
             if(editor->_select_on == false) {
                 // Record information for undo/redo action.
-                //_tile_indeces.push_back(_move_source_index);
+                _tile_indeces.push_back(QPoint(_move_source_index_x, _move_source_index_y));
                 _previous_tiles.push_back(layer[_move_source_index_y][_move_source_index_x]);
                 _modified_tiles.push_back(-1);
-                //_tile_indeces.push_back(_tile_index);
+                _tile_indeces.push_back(QPoint(_tile_index_x, _tile_index_y));
                 _previous_tiles.push_back(layer[_tile_index_y][_tile_index_x]);
                 _modified_tiles.push_back(layer[_move_source_index_y][_move_source_index_x]);
 
                 // Perform the move.
                 layer[_tile_index_y][_tile_index_x] = layer[_move_source_index_y][_move_source_index_x];
                 layer[_move_source_index_y][_move_source_index_x] = -1;
+                _MarkTileDirty(_tile_index_x, _tile_index_y);
+                _MarkTileDirty(_move_source_index_x, _move_source_index_y);
             } // only moving one tile at a time
             else {
-                std::vector<std::vector<int32_t> > select_layer = GetSelectionLayer();
-                for(int32_t y = 0; y < static_cast<int32_t>(select_layer.size()); ++y) {
-                    for(int32_t x = 0; x < static_cast<int32_t>(select_layer[y].size()); ++x) {
+                const LayerTiles& select_layer = GetSelectionLayer();
+                for(int32_t y = 0; y < static_cast<int32_t>(select_layer.GetHeight()); ++y) {
+                    for(int32_t x = 0; x < static_cast<int32_t>(select_layer.GetWidth()); ++x) {
                         // Works because the selection layer and the current layer
                         // have the same size.
                         if(select_layer[y][x] != -1) {
@@ -1062,20 +1327,22 @@ void Grid::mouseReleaseEvent(QGraphicsSceneMouseEvent *evt)
                             // Perform the move.
                             layer[y + _tile_index_y - _move_source_index_y][x + _tile_index_x - _move_source_index_x] = layer[y][x];
                             layer[y][x] = -1;
+                            _MarkTileDirty(x + _tile_index_x - _move_source_index_x, y + _tile_index_y - _move_source_index_y);
+                            _MarkTileDirty(x, y);
                         } // only if current tile is selected
                     } // x
                 } // y
             } // moving a bunch of tiles at once
 
             // Push command onto the undo stack.
-            LayerCommand *move_command = new LayerCommand(_tile_indeces,
-                    _previous_tiles, _modified_tiles, _layer_id, editor, "Move");
+            LayerCommand *move_command = new LayerCommand(TileDelta(_tile_indeces,
+                    _previous_tiles, _modified_tiles), _layer_id, editor, "Move");
             editor->_undo_stack->push(move_command);
             _tile_indeces.clear();
             _previous_tiles.clear();
             _modified_tiles.clear();
 
-            UpdateScene();
+            UpdateDirtyTiles();
         } // moving tiles and not selecting them
 
         break;
@@ -1083,21 +1350,21 @@ void Grid::mouseReleaseEvent(QGraphicsSceneMouseEvent *evt)
 
     case DELETE_TILE: { // wrap up deleting tiles
         if(editor->_select_on == true) {
-            std::vector<std::vector<int32_t> > select_layer = GetSelectionLayer();
-            for(int32_t y = 0; y < static_cast<int32_t>(select_layer.size()); ++y) {
-                for(int32_t x = 0; x < static_cast<int32_t>(select_layer[y].size()); ++x) {
+            const LayerTiles& select_layer = GetSelectionLayer();
+            for(int32_t y = 0; y < static_cast<int32_t>(select_layer.GetHeight()); ++y) {
+                for(int32_t x = 0; x < static_cast<int32_t>(select_layer.GetWidth()); ++x) {
                     // Works because the selection layer and the current layer
                     // are the same size.
                     if(select_layer[y][x] != -1)
                         _DeleteTile(x, y);
                 } // x
             } // y
-            UpdateScene();
+            UpdateDirtyTiles();
         } // only if deleting a bunch of tiles
 
         // Push command onto undo stack.
-        LayerCommand *delete_command = new LayerCommand(_tile_indeces,
-                _previous_tiles, _modified_tiles, _layer_id, editor, "Delete");
+        LayerCommand *delete_command = new LayerCommand(TileDelta(_tile_indeces,
+                _previous_tiles, _modified_tiles), _layer_id, editor, "Delete", DELETE_TILE, _stroke_start_time);
         editor->_undo_stack->push(delete_command);
         _tile_indeces.clear();
         _previous_tiles.clear();
@@ -1113,7 +1380,6 @@ void Grid::mouseReleaseEvent(QGraphicsSceneMouseEvent *evt)
     // Clear the selection layer.
     if((_tile_mode != MOVE_TILE || _moving == true) && editor->_select_on == true) {
         ClearSelectionLayer();
-        UpdateScene();
     } // clears when not moving tiles or when moving tiles and not selecting them
 
     if(editor->_select_on == true && _moving == false && _tile_mode == MOVE_TILE)
@@ -1154,22 +1420,34 @@ void Grid::keyPressEvent(QKeyEvent *evt)
 
 void Grid::_MapInsertRow()
 {
-    InsertRow(_tile_index_y);
+    Editor *editor = static_cast<Editor *>(_graphics_view->topLevelWidget());
+    GridSnapshot previous_map = GetSnapshot();
+    if(InsertRow(_tile_index_y))
+        editor->_PushMapCommand(std::move(previous_map), "Insert Row");
 }
 
 void Grid::_MapInsertColumn()
 {
-    InsertCol(_tile_index_x);
+    Editor *editor = static_cast<Editor *>(_graphics_view->topLevelWidget());
+    GridSnapshot previous_map = GetSnapshot();
+    if(InsertCol(_tile_index_x))
+        editor->_PushMapCommand(std::move(previous_map), "Insert Column");
 }
 
 void Grid::_MapDeleteRow()
 {
-    DeleteRow(_tile_index_y);
+    Editor *editor = static_cast<Editor *>(_graphics_view->topLevelWidget());
+    GridSnapshot previous_map = GetSnapshot();
+    if(DeleteRow(_tile_index_y))
+        editor->_PushMapCommand(std::move(previous_map), "Delete Row");
 }
 
 void Grid::_MapDeleteColumn()
 {
-    DeleteCol(_tile_index_x);
+    Editor *editor = static_cast<Editor *>(_graphics_view->topLevelWidget());
+    GridSnapshot previous_map = GetSnapshot();
+    if(DeleteCol(_tile_index_x))
+        editor->_PushMapCommand(std::move(previous_map), "Delete Column");
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -1180,12 +1458,12 @@ void Grid::_PaintTile(int32_t index_x, int32_t index_y)
 {
     // get reference to current tileset
     Editor *editor = static_cast<Editor *>(_graphics_view->topLevelWidget());
-    QTableWidget *table = static_cast<QTableWidget *>(editor->_ed_tabs->currentWidget());
+    QTableView *table = static_cast<QTableView *>(editor->_ed_tabs->currentWidget());
     QString tileset_name = tileset_def_names.at(editor->_ed_tabs->currentIndex());
 
     // Detect the first selection range and use to paint an area
-    QList<QTableWidgetSelectionRange> selections = table->selectedRanges();
-    QTableWidgetSelectionRange selection;
+    const QItemSelection selections = table->selectionModel()->selection();
+    QItemSelectionRange selection;
     if(selections.size() > 0)
         selection = selections.at(0);
 
@@ -1196,11 +1474,11 @@ void Grid::_PaintTile(int32_t index_x, int32_t index_y)
         return;
     }
 
-    if(selections.size() > 0 && (selection.columnCount() * selection.rowCount() > 1)) {
+    if(selections.size() > 0 && (selection.width() * selection.height() > 1)) {
         // Draw tiles from tileset selection onto map, one tile at a time.
-        for(int32_t i = 0; i < selection.rowCount() && index_y + i < (int32_t)GetHeight(); i++) {
-            for(int32_t j = 0; j < selection.columnCount() && index_x + j < (int32_t)GetWidth(); j++) {
-                int32_t tileset_index = (selection.topRow() + i) * 16 + (selection.leftColumn() + j);
+        for(int32_t i = 0; i < selection.height() && index_y + i < (int32_t)GetHeight(); i++) {
+            for(int32_t j = 0; j < selection.width() && index_x + j < (int32_t)GetWidth(); j++) {
+                int32_t tileset_index = (selection.top() + i) * 16 + (selection.left() + j);
 
                 // perform randomization for autotiles
                 _AutotileRandomize(multiplier, tileset_index);
@@ -1211,12 +1489,13 @@ void Grid::_PaintTile(int32_t index_x, int32_t index_y)
                 _modified_tiles.push_back(tileset_index + multiplier * 256);
 
                 GetCurrentLayer()[index_y + i][index_x + j] = tileset_index + multiplier * 256;
+                _MarkTileDirty(index_x + j, index_y + i);
             } // iterate through columns of selection
         } // iterate through rows of selection
     } // multiple tiles are selected
     else {
         // put selected tile from tileset into tile array at correct position
-        int32_t tileset_index = table->currentRow() * 16 + table->currentColumn();
+        int32_t tileset_index = table->currentIndex().row() * 16 + table->currentIndex().column();
 
         // perform randomization for autotiles
         _AutotileRandomize(multiplier, tileset_index);
@@ -1227,6 +1506,7 @@ void Grid::_PaintTile(int32_t index_x, int32_t index_y)
         _modified_tiles.push_back(tileset_index + multiplier * 256);
 
         GetCurrentLayer()[index_y][index_x] = tileset_index + multiplier * 256;
+        _MarkTileDirty(index_x, index_y);
     } // a single tile is selected
 }
 
@@ -1239,6 +1519,7 @@ void Grid::_DeleteTile(int32_t index_x, int32_t index_y)
 
     // Delete the tile.
     GetCurrentLayer()[index_y][index_x] = -1;
+    _MarkTileDirty(index_x, index_y);
 }
 
 void Grid::_AutotileRandomize(int32_t &tileset_num, int32_t &tile_index)
@@ -1256,23 +1537,23 @@ void Grid::_AutotileRandomize(int32_t &tileset_num, int32_t &tile_index)
     if(it == tilesets[tileset_num]->autotileability.end())
         return;
 
-    // Set up for opening autotiling.lua.
-    ReadScriptDescriptor read_data;
-    if(read_data.OpenFile("data/tilesets/autotiling.lua") == false)
-        QMessageBox::warning(_graphics_view, "Loading File...",
-                                QString("ERROR: could not open data/tilesets/autotiling.lua for reading!"));
-
-    read_data.OpenTable(it->second);
-    int32_t random_index = vt_utils::RandomBoundedInteger(1, static_cast<int32_t>(read_data.GetTableSize()));
-    read_data.OpenTable(random_index);
-    std::string tileset_name = read_data.ReadString(1);
-    tile_index = read_data.ReadInt(2);
-    read_data.CloseTable();
-    tileset_num = tileset_def_names.indexOf(
-                        QString(tileset_name.c_str()));
-    read_data.CloseTable();
+    // The groups are cached by the editor, so that the autotiling file isn't parsed for each tile.
+    AutotilingTable &autotiling = static_cast<Editor *>(_graphics_view->topLevelWidget())->_autotiling;
+    const AutotileGroup *group = autotiling.GetGroup(it->second);
+    if(group == nullptr) {
+        // Only warn once until the file changes
+        if(autotiling.ReportLoadFailure())
+            QMessageBox::warning(_graphics_view, "Loading File...",
+                                 QString("ERROR: could not open data/tilesets/autotiling.lua for reading!"));
+        return;
+    }
 
-    read_data.CloseFile();
+    if(group->empty())
+        return;
+
+    const AutotileVariant &variant = (*group)[vt_utils::RandomBoundedInteger(0, static_cast<int32_t>(group->size()) - 1)];
+    tile_index = variant.tile_index;
+    tileset_num = tileset_def_names.indexOf(variant.tileset_name);
 
     _AutotileTransitions(tileset_num, tile_index, it->second);
 }
@@ -1660,4 +1941,130 @@ TRANSITION_PATTERN_TYPE Grid::_CheckForTransitionPattern(const std::string &curr
     return INVALID_PATTERN;
 } // TRANSITION_PATTERN_TYPE EditorScrollView::_CheckForTransitionPattern(...)
 
+///////////////////////////////////////////////////////////////////////////////
+// LayerItem class -- all functions
+///////////////////////////////////////////////////////////////////////////////
+
+//! \brief Stacks the selection squares above any tile layer.
+const qreal SELECTION_Z_VALUE = 100000;
+
+LayerItem::LayerItem(Grid *grid, int32_t layer_id) :
+    _grid(grid),
+    _layer_id(layer_id),
+    _chunk_columns(0),
+    _chunk_rows(0)
+{
+    // Needed to get the exposed rectangle when painting
+    setFlag(QGraphicsItem::ItemUsesExtendedStyleOption);
+    SetLayerId(layer_id);
+}
+
+LayerItem::~LayerItem()
+{
+    InvalidateAll();
+}
+
+void LayerItem::SetLayerId(int32_t layer_id)
+{
+    _layer_id = layer_id;
+    setZValue(layer_id == SELECTION_LAYER_ID ? SELECTION_Z_VALUE : layer_id);
+}
+
+void LayerItem::SetMapSize(uint32_t width, uint32_t height)
+{
+    QRectF bounding_rect(0, 0, width * TILE_WIDTH, height * TILE_HEIGHT);
+    if(bounding_rect == _bounding_rect)
+        return;
+
+    prepareGeometryChange();
+    _bounding_rect = bounding_rect;
+
+    InvalidateAll();
+    _chunk_columns = (width + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    _chunk_rows = (height + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    _chunk_keys.assign(_chunk_columns * _chunk_rows, QPixmapCache::Key());
+}
+
+void LayerItem::InvalidateTiles(const QRect &tile_area)
+{
+    QRect area = tile_area & QRect(0, 0, _chunk_columns * CHUNK_SIZE, _chunk_rows * CHUNK_SIZE);
+    if(area.isEmpty())
+        return;
+
+    for(int32_t chunk_y = area.top() / CHUNK_SIZE; chunk_y <= area.bottom() / CHUNK_SIZE; ++chunk_y) {
+        for(int32_t chunk_x = area.left() / CHUNK_SIZE; chunk_x <= area.right() / CHUNK_SIZE; ++chunk_x) {
+            QPixmapCache::Key &key = _chunk_keys[chunk_y * _chunk_columns + chunk_x];
+            QPixmapCache::remove(key);
+            key = QPixmapCache::Key();
+        }
+    }
+}
+
+void LayerItem::InvalidateAll()
+{
+    for(uint32_t i = 0; i < _chunk_keys.size(); ++i) {
+        QPixmapCache::remove(_chunk_keys[i]);
+        _chunk_keys[i] = QPixmapCache::Key();
+    }
+}
+
+void LayerItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget * /*widget*/)
+{
+    QRect tile_area;
+    if(!_grid->_GetTileArea(option->exposedRect, tile_area))
+        return;
+
+    if(_layer_id == SELECTION_LAYER_ID) {
+        _grid->_DrawLayerTiles(painter, _grid->_select_layer, tile_area.left(), tile_area.top(),
+                               tile_area.right(), tile_area.bottom(), true);
+        return;
+    }
+
+    if(_layer_id >= static_cast<int32_t>(_grid->_tile_layers.size()) || _chunk_keys.empty())
+        return;
+
+    const LayerTiles &tiles = _grid->_tile_layers[_layer_id].tiles;
+    const int32_t chunk_width = CHUNK_SIZE * TILE_WIDTH;
+    const int32_t chunk_height = CHUNK_SIZE * TILE_HEIGHT;
+    for(int32_t chunk_y = tile_area.top() / CHUNK_SIZE; chunk_y <= tile_area.bottom() / CHUNK_SIZE; ++chunk_y) {
+        for(int32_t chunk_x = tile_area.left() / CHUNK_SIZE; chunk_x <= tile_area.right() / CHUNK_SIZE; ++chunk_x) {
+            // The layer chunks are bigger, and contain whole item chunks.
+            if(tiles.IsChunkEmpty(chunk_x * CHUNK_SIZE / LAYER_CHUNK_SIZE,
+                                  chunk_y * CHUNK_SIZE / LAYER_CHUNK_SIZE))
+                continue;
+
+            QPixmapCache::Key &key = _chunk_keys[chunk_y * _chunk_columns + chunk_x];
+            QPixmap pixmap;
+            if(!QPixmapCache::find(key, &pixmap)) {
+                pixmap = _DrawChunk(tiles, chunk_x, chunk_y);
+                key = QPixmapCache::insert(pixmap);
+            }
+
+            // Only blit the exposed part of the chunk
+            QRect target = QRect(chunk_x * chunk_width, chunk_y * chunk_height, pixmap.width(), pixmap.height())
+                           & option->exposedRect.toAlignedRect();
+            if(!target.isEmpty())
+                painter->drawPixmap(target, pixmap,
+                                    target.translated(-chunk_x * chunk_width, -chunk_y * chunk_height));
+        }
+    }
+}
+
+QPixmap LayerItem::_DrawChunk(const LayerTiles &tiles, int32_t chunk_x, int32_t chunk_y) const
+{
+    // Chunks on the map borders are cut to the map size
+    int32_t left = chunk_x * CHUNK_SIZE;
+    int32_t top = chunk_y * CHUNK_SIZE;
+    int32_t right = std::min(left + CHUNK_SIZE, static_cast<int32_t>(_grid->GetWidth())) - 1;
+    int32_t bottom = std::min(top + CHUNK_SIZE, static_cast<int32_t>(_grid->GetHeight())) - 1;
+
+    QPixmap pixmap((right - left + 1) * TILE_WIDTH, (bottom - top + 1) * TILE_HEIGHT);
+    pixmap.fill(Qt::transparent);
+
+    QPainter painter(&pixmap);
+    painter.translate(-left * static_cast<int32_t>(TILE_WIDTH), -top * static_cast<int32_t>(TILE_HEIGHT));
+    _grid->_DrawLayerTiles(&painter, tiles, left, top, right, bottom, false);
+    return pixmap;
+}
+
 } // namespace vt_editor
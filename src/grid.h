@@ -19,10 +19,13 @@
 #define __GRID_HEADER__
 
 #include <QGraphicsScene>
+#include <QGraphicsItem>
+#include <QPixmapCache>
 #include <QStringList>
 #include <QMessageBox>
 #include <QTreeWidgetItem>
 
+#include "layer.h"
 #include "tileset.h"
 
 namespace vt_editor
@@ -32,6 +35,9 @@ namespace vt_editor
 const uint32_t map_min_width = 16;
 const uint32_t map_min_height = 12;
 
+//! \brief Set in the collision masks where a tile exists, along with the WALKABILITY_MASK bits.
+const uint8_t TILE_PRESENT_MASK = 0x10;
+
 //! \brief Represents different types of transition patterns for autotileable tiles.
 enum TRANSITION_PATTERN_TYPE {
     INVALID_PATTERN     = -1,
@@ -59,64 +65,22 @@ enum TILE_MODE_TYPE {
     TOTAL_TILE     = 3
 };
 
-//! \brief Different tile layers in the map.
-enum LAYER_TYPE {
-    INVALID_LAYER = -1,
-    GROUND_LAYER  =  0,
-    SKY_LAYER     =  1,
-    SELECT_LAYER  =  2,
-    TOTAL_LAYER   =  3
-};
-
-LAYER_TYPE &operator++(LAYER_TYPE &value, int dummy);
-
 class EditorScrollArea;
-
-// A simplified struct used to pass everything but the tiles info
-struct LayerInfo {
-    std::string name;
-    LAYER_TYPE layer_type;
-
-    LayerInfo() {
-        layer_type = GROUND_LAYER;
-    }
-};
-
-class Layer
-{
-public:
-    std::string name;
-    LAYER_TYPE layer_type;
-    // Represents the tile indeces: i.e: tiles[y][x] = tile_id at (x,y)
-    std::vector< std::vector<int32_t> > tiles;
-    // Tells whether the layer is currently visible.
-    bool visible;
-
-    Layer() {
-        layer_type = GROUND_LAYER;
-        visible = true;
-    }
-
-    // Resize a layer to the given map size
-    void Resize(uint32_t width, uint height) {
-        tiles.resize(height);
-        for(uint32_t y = 0; y < height; ++y)
-            tiles[y].resize(width);
-    }
-
-    // Fill a layer with the given tile index value.
-    void Fill(int32_t tile_id = -1) {
-        for(uint32_t y = 0; y < tiles.size(); ++y) {
-            for(uint32_t x = 0; x < tiles[y].size(); ++x)
-                tiles[y][x] = tile_id;
-        }
-    }
+class LayerItem;
+
+//! \brief The map layers and size, kept to undo the changes of the map structure.
+//! The layers share their tiles with the map ones until either is modified.
+struct GridSnapshot {
+    uint32_t width;
+    uint32_t height;
+    std::vector<Layer> layers;
+
+    GridSnapshot():
+        width(0),
+        height(0)
+    {}
 };
 
-LAYER_TYPE getLayerType(const std::string &type);
-std::string getTypeFromLayer(const LAYER_TYPE &type);
-
-
 /** ***************************************************************************
 *** \brief Used for the OpenGL map portion where tiles are painted and edited.
 ***
@@ -139,6 +103,8 @@ class Grid : public QGraphicsScene
     friend class MapPropertiesDialog;
     friend class LayerDialog;
     friend class LayerCommand;
+    friend class MapCommand;
+    friend class LayerItem;
 
 public:
     Grid(QWidget *parent = 0, const QString &name = QString(tr("Untitled")),
@@ -165,11 +131,12 @@ public:
         return _tile_layers;
     }
 
-    std::vector<std::vector<int32_t> >& GetSelectionLayer() {
+    LayerTiles& GetSelectionLayer() {
         return _select_layer;
     }
 
-    // Fill the selection layer with the empty tile (-1) value.
+    // Fill the selection layer with the empty tile (-1) value,
+    // and redraws the selection squares removed.
     void ClearSelectionLayer();
 
     void SetFileName(QString filename) {
@@ -195,13 +162,15 @@ public:
         _initialized = ready;
     }
 
+    //! The grid and the selection squares are drawn over the layers,
+    //! so the layers don't need to be drawn again.
     void SetGridOn(bool value)   {
         _grid_on   = value;
-        UpdateScene();
+        update(sceneRect());
     }
     void SetSelectOn(bool value) {
         _select_on = value;
-        UpdateScene();
+        _selection_item->setVisible(value);
     }
     //@}
 
@@ -233,6 +202,18 @@ public:
     **/
     void DeleteLayer(uint32_t layer_id);
 
+    //! \brief Shows or hides a layer. Only the layer item visibility changes.
+    void SetLayerVisible(uint32_t layer_id, bool visible);
+
+    //! \brief Swaps two layers. The layer items are restacked, nothing else is redrawn.
+    void SwapLayers(uint32_t first_layer_id, uint32_t second_layer_id);
+
+    //! \brief Returns the map layers and size. Only the tile chunk pointers are copied.
+    GridSnapshot GetSnapshot() const;
+
+    //! \brief Sets the map layers and size back to the snapshot ones, and redraws the map.
+    void RestoreSnapshot(const GridSnapshot &snapshot);
+
     /** \name Context Modification Functions (Right-Click)
     *** \brief Functions to insert or delete rows or columns of tiles from the
     ***        map.
@@ -240,15 +221,17 @@ public:
     ***        used to determine the row or column upon which to perform the
     ***        operation.
     ***
+    *** \return False when the map wasn't modified.
+    ***
     *** \note This feature is accessed by right-clicking on the map. It could
     ***       be used elsewhere if the proper tile index is passed as a
     ***       parameter.
     **/
     //{@
-    void InsertRow(uint32_t tile_index);
-    void InsertCol(uint32_t tile_index);
-    void DeleteRow(uint32_t tile_index);
-    void DeleteCol(uint32_t tile_index);
+    bool InsertRow(uint32_t tile_index);
+    bool InsertCol(uint32_t tile_index);
+    bool DeleteRow(uint32_t tile_index);
+    bool DeleteCol(uint32_t tile_index);
     //@}
 
     //! \brief List the layer names, types, ...
@@ -270,10 +253,68 @@ public:
     // Pointer to the graphic view class, used to display the graphics widgets.
     QGraphicsView* _graphics_view;
 
-    //! \brief Paints the entire map with the video engine.
+    //! \brief Refreshes the entire map display.
     void UpdateScene();
 
+    //! \brief Only redraws the tiles marked as modified since the last scene update.
+    //! Their collision masks are updated as well.
+    void UpdateDirtyTiles();
+
+    //! \brief Only redraws the selection squares marked as modified since the last update.
+    //! The layers and the collision masks are left untouched.
+    void UpdateDirtySelection();
+
+    /** \brief Recomputes the whole collision grid.
+    ***
+    *** The single tile changes are handled through UpdateDirtyTiles(). This is needed
+    *** when the tilesets, the map size or the ground layers are changed.
+    **/
+    void UpdateCollisionGrid();
+
+    //! \brief Returns the collision mask of the given map cell: WALKABILITY_MASK bits,
+    //! plus TILE_PRESENT_MASK when a tile exists there on a ground layer.
+    uint8_t GetCollisionMask(uint32_t x, uint32_t y) const {
+        return _collision_masks[y * _width + x];
+    }
+
 private:
+    /** \name Map Cache Functions
+    *** \brief A binary copy of the map data saved next to the Lua file.
+    ***
+    *** It holds the map size, tilesets, layers and raw tile rows, along with a hash
+    *** of the Lua file content. LoadMap() uses it instead of parsing the Lua file
+    *** when the hash still matches, i.e. when the map wasn't modified elsewhere since.
+    **/
+    //{@
+    QString _GetMapCacheFilename() const;
+    //! \return True only when the map data was loaded from a valid cache.
+    bool _LoadMapCache();
+    void _SaveMapCache();
+    //@}
+
+    /** \brief The walkability mask of every tile id of the map tilesets, found at
+    *** _tile_masks[tile_id + 1] so that the empty tile (-1) gives 0.
+    *** Tiles found in the tilesets have the TILE_PRESENT_MASK bit set as well.
+    **/
+    std::vector<uint8_t> _tile_masks;
+
+    //! \brief The collision mask of each map cell, row by row: the OR of the
+    //! tile masks of the ground layers. Kept up to date as the tiles change.
+    std::vector<uint8_t> _collision_masks;
+
+    //! \brief Returns the walkability mask of the given tile id.
+    uint8_t _GetTileMask(int32_t tile_id) const {
+        // Tiles of unknown tilesets are there, but don't block anything.
+        uint32_t index = static_cast<uint32_t>(tile_id + 1);
+        return index < _tile_masks.size() ? _tile_masks[index] : TILE_PRESENT_MASK;
+    }
+
+    //! \brief ORs the mask of each of the count tiles into cell_masks.
+    void _OrTileMasks(const int32_t *tiles, uint8_t *cell_masks, uint32_t count) const;
+
+    //! \brief Recomputes the collision masks of the given map area.
+    void _UpdateCollisionMasks(const QRect &area);
+
     // Computes the next layer id to put for the givent layer type,
     // Used when creating a new layer.
     uint32_t _GetNextLayerId(const LAYER_TYPE &layer_type);
@@ -306,15 +347,50 @@ private:
     *** nor the game. It acts similar to an actual tile layer as far as drawing
     *** is concerned.
     **/
-    std::vector<std::vector<int32_t> > _select_layer;
+    LayerTiles _select_layer;
+
+    //! \brief The map area (in tiles) modified since the last scene update.
+    QRect _dirty_tiles;
+
+    //! \brief Marks the tile at the given map location as needing a redraw.
+    void _MarkTileDirty(int32_t x, int32_t y);
+
+    //! \brief The selection layer area (in tiles) modified since the last selection update.
+    QRect _dirty_selection;
+
+    //! \brief Marks the selection square at the given map location as needing a redraw.
+    void _MarkSelectionDirty(int32_t x, int32_t y);
+
+    //! \brief The scene item of each tile layer, stacked by layer id.
+    std::vector<LayerItem *> _layer_items;
+    //! \brief The scene item of the selection squares, above every layer.
+    LayerItem *_selection_item;
+
+    //! \brief Creates or deletes the layer items to match the layers,
+    //! and updates their size and visibility.
+    void _UpdateLayerItems();
 
-    // Draw the tile grid (actually adds the line to the graphics scene)
-    void _DrawGrid();
+    //! \brief Gives the map tiles found within the given scene rectangle.
+    //! \return False when no tile is there.
+    bool _GetTileArea(const QRectF &rect, QRect &tile_area) const;
+
+    //! \brief Draws the tiles of the given layer found within the given tile area,
+    //! skipping the empty chunks. The selection squares are drawn when selection is true.
+    void _DrawLayerTiles(QPainter *painter, const LayerTiles &tiles,
+                         int32_t left, int32_t top, int32_t right, int32_t bottom,
+                         bool selection);
+
+    //! \brief Draws the tile grid lines crossing the given scene rectangle.
+    void _DrawGrid(QPainter *painter, const QRectF &rect);
 
     //! Gets currently edited layer
-    std::vector<std::vector<int32_t> >& GetCurrentLayer();
+    LayerTiles& GetCurrentLayer();
 
 protected:
+    //! \brief Paints the tile grid over the exposed rectangle, when toggled on,
+    //! and the map borders.
+    void drawForeground(QPainter *painter, const QRectF &rect);
+
     //! \name Mouse Processing Functions
     //! \brief Functions to process mouse events on the map.
     //! \note Reimplemented from QScrollArea.
@@ -401,6 +477,10 @@ private:
     //! the rectangle and moves it to another location.
     bool _moving;
 
+    //! When the mouse button was last pressed on the map, in ms since epoch.
+    //! This is the start of the paint or delete stroke being done.
+    qint64 _stroke_start_time;
+
     //! \name Tile Vectors
     //! \brief The following three vectors are used to know how to perform undo and redo operations
     //!        for this command. They should be the same size and one-to-one. So, the j-th element
@@ -413,6 +493,71 @@ private:
 
 }; // class Grid : public QGraphicsScene
 
+/** ***************************************************************************
+*** \brief Draws one tile layer of a Grid, or its selection squares.
+***
+*** Each layer has its own scene item, stacked by layer id. Showing, hiding or
+*** reordering layers thus only changes the items, and Qt only repaints the
+*** concerned area.
+***
+*** The layer is drawn by chunks of CHUNK_SIZE x CHUNK_SIZE tiles, kept as
+*** pixmaps in the QPixmapCache, so that painting an unchanged area only blits
+*** a few pixmaps. The chunks are drawn again once invalidated, or when the
+*** cache dropped them. The often changing selection squares aren't cached.
+*** **************************************************************************/
+class LayerItem : public QGraphicsItem
+{
+public:
+    //! \brief The layer id used by the selection squares item.
+    static const int32_t SELECTION_LAYER_ID = -1;
+
+    //! \brief The chunks width and height, in tiles.
+    static const int32_t CHUNK_SIZE = 16;
+
+    LayerItem(Grid *grid, int32_t layer_id);
+
+    ~LayerItem();
+
+    //! \brief Sets the layer drawn by this item, and stacks the item accordingly.
+    void SetLayerId(int32_t layer_id);
+
+    //! \brief Sets the map size, in tiles.
+    void SetMapSize(uint32_t width, uint32_t height);
+
+    //! \brief Drops the cached chunks intersecting the given map area, in tiles.
+    void InvalidateTiles(const QRect &tile_area);
+
+    //! \brief Drops all the cached chunks.
+    void InvalidateAll();
+
+    QRectF boundingRect() const {
+        return _bounding_rect;
+    }
+
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget);
+
+private:
+    //! \brief The map the layer belongs to.
+    Grid *_grid;
+
+    //! \brief The id of the layer drawn, or SELECTION_LAYER_ID.
+    int32_t _layer_id;
+
+    //! \brief The whole map area.
+    QRectF _bounding_rect;
+
+    //! \brief The map size, in chunks.
+    int32_t _chunk_columns;
+    int32_t _chunk_rows;
+
+    //! \brief The cache key of each chunk pixmap, row by row.
+    //! Invalid keys stand for chunks not drawn yet.
+    std::vector<QPixmapCache::Key> _chunk_keys;
+
+    //! \brief Draws the given chunk of the layer into a new pixmap.
+    QPixmap _DrawChunk(const LayerTiles &tiles, int32_t chunk_x, int32_t chunk_y) const;
+};
+
 } // namespace vt_editor
 
 #endif // __GRID_HEADER__
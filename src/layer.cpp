@@ -0,0 +1,285 @@
+///////////////////////////////////////////////////////////////////////////////
+//            Copyright (C) 2004-2011 by The Allacrost Project
+//            Copyright (C) 2012-2015 by Bertram (Valyria Tear)
+//                         All Rights Reserved
+//
+// This code is licensed under the GNU GPL version 2. It is free software
+// and you may modify it and/or redistribute it under the terms of this license.
+// See http://www.gnu.org/copyleft/gpl.html for details.
+///////////////////////////////////////////////////////////////////////////////
+
+/** ***************************************************************************
+*** \file    layer.cpp
+*** \author  Yohann Ferreira, yohann ferreira orange fr
+*** \brief   Source file for the map tile layers data.
+*** **************************************************************************/
+
+#include "layer.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace vt_editor
+{
+
+LAYER_TYPE getLayerType(const std::string &type)
+{
+    if(type == "ground")
+        return GROUND_LAYER;
+    else if(type == "sky")
+        return SKY_LAYER;
+
+    return INVALID_LAYER;
+
+}
+
+
+std::string getTypeFromLayer(const LAYER_TYPE &type)
+{
+
+    switch(type) {
+    case GROUND_LAYER:
+        return "ground";
+    case SKY_LAYER:
+        return "sky";
+    default:
+        break;
+    };
+    return "other";
+}
+
+
+
+LAYER_TYPE &operator++(LAYER_TYPE &value, int /*dummy*/)
+{
+    value = static_cast<LAYER_TYPE>(static_cast<int>(value) + 1);
+    return value;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// LayerTiles class
+///////////////////////////////////////////////////////////////////////////////
+
+const std::shared_ptr<LayerTiles::Chunk>& LayerTiles::_GetEmptyChunk()
+{
+    static const std::shared_ptr<Chunk> empty_chunk(new Chunk(LAYER_CHUNK_SIZE * LAYER_CHUNK_SIZE, -1));
+    return empty_chunk;
+}
+
+void LayerTiles::SetSparse(bool sparse)
+{
+    if(sparse == _sparse)
+        return;
+
+    // The chunks holding tiles are kept as they are.
+    _sparse = sparse;
+    const std::shared_ptr<Chunk> &empty_chunk = _GetEmptyChunk();
+    for(uint32_t i = 0; i < _chunks.size(); ++i) {
+        if(!_sparse && _chunks[i] == empty_chunk)
+            _chunks[i] = std::make_shared<Chunk>(*empty_chunk);
+        else if(_sparse && *_chunks[i] == *empty_chunk)
+            _chunks[i] = empty_chunk;
+    }
+}
+
+void LayerTiles::SetTile(uint32_t x, uint32_t y, int32_t tile_id)
+{
+    std::shared_ptr<Chunk> &chunk = _chunks[(y / LAYER_CHUNK_SIZE) * _chunk_columns + x / LAYER_CHUNK_SIZE];
+    uint32_t index = (y % LAYER_CHUNK_SIZE) * LAYER_CHUNK_SIZE + x % LAYER_CHUNK_SIZE;
+    if((*chunk)[index] == tile_id)
+        return;
+
+    _DetachChunk(chunk);
+    (*chunk)[index] = tile_id;
+}
+
+void LayerTiles::GetRow(uint32_t y, std::vector<int32_t> &row) const
+{
+    row.resize(_width);
+    GetRow(y, row.data());
+}
+
+void LayerTiles::GetRow(uint32_t y, int32_t *row) const
+{
+    // Copy the row part found in each chunk
+    uint32_t chunk_y = y / LAYER_CHUNK_SIZE;
+    uint32_t offset = (y % LAYER_CHUNK_SIZE) * LAYER_CHUNK_SIZE;
+    for(uint32_t chunk_x = 0; chunk_x < _chunk_columns; ++chunk_x) {
+        const Chunk &chunk = *_chunks[chunk_y * _chunk_columns + chunk_x];
+        uint32_t x = chunk_x * LAYER_CHUNK_SIZE;
+        uint32_t count = std::min(LAYER_CHUNK_SIZE, _width - x);
+        std::copy(chunk.begin() + offset, chunk.begin() + offset + count, row + x);
+    }
+}
+
+void LayerTiles::SetRow(uint32_t y, const std::vector<int32_t> &row)
+{
+    SetRow(y, row.data());
+}
+
+void LayerTiles::SetRow(uint32_t y, const int32_t *row)
+{
+    // Only write the row parts which changed, so that the chunks left
+    // untouched stay shared.
+    uint32_t chunk_y = y / LAYER_CHUNK_SIZE;
+    uint32_t offset = (y % LAYER_CHUNK_SIZE) * LAYER_CHUNK_SIZE;
+    for(uint32_t chunk_x = 0; chunk_x < _chunk_columns; ++chunk_x) {
+        std::shared_ptr<Chunk> &chunk = _chunks[chunk_y * _chunk_columns + chunk_x];
+        uint32_t x = chunk_x * LAYER_CHUNK_SIZE;
+        uint32_t count = std::min(LAYER_CHUNK_SIZE, _width - x);
+        if(std::equal(row + x, row + x + count, chunk->begin() + offset))
+            continue;
+
+        _DetachChunk(chunk);
+        std::copy(row + x, row + x + count, chunk->begin() + offset);
+    }
+}
+
+void LayerTiles::OptimizeStorage()
+{
+    if(_sparse && GetUsedChunkCount() * 2 > _chunk_columns * _chunk_rows)
+        SetSparse(false);
+}
+
+uint32_t LayerTiles::GetUsedChunkCount() const
+{
+    uint32_t count = 0;
+    for(uint32_t i = 0; i < _chunks.size(); ++i) {
+        if(_chunks[i] != _GetEmptyChunk())
+            ++count;
+    }
+    return count;
+}
+
+void LayerTiles::Resize(uint32_t width, uint32_t height)
+{
+    if(width == _width && height == _height)
+        return;
+
+    // Nothing to keep
+    if(_width == 0 || _height == 0) {
+        _Allocate(width, height, _sparse);
+        return;
+    }
+
+    _Remap(width, height, _sparse, _width, 0, _height, 0);
+}
+
+void LayerTiles::Fill(int32_t tile_id)
+{
+    if(!_sparse) {
+        // No need to copy the shared chunks which get overwritten
+        for(uint32_t i = 0; i < _chunks.size(); ++i) {
+            if(_chunks[i].use_count() > 1)
+                _chunks[i] = std::make_shared<Chunk>(LAYER_CHUNK_SIZE * LAYER_CHUNK_SIZE, tile_id);
+            else
+                std::fill(_chunks[i]->begin(), _chunks[i]->end(), tile_id);
+        }
+        return;
+    }
+
+    // A single chunk is shared by the whole layer until it gets modified.
+    std::shared_ptr<Chunk> chunk = _GetEmptyChunk();
+    if(tile_id != -1)
+        chunk = std::make_shared<Chunk>(LAYER_CHUNK_SIZE * LAYER_CHUNK_SIZE, tile_id);
+    std::fill(_chunks.begin(), _chunks.end(), chunk);
+}
+
+void LayerTiles::InsertRow(uint32_t y)
+{
+    if(y > _height)
+        return;
+
+    _Remap(_width, _height + 1, _sparse, _width, 0, y, 1);
+}
+
+void LayerTiles::InsertCol(uint32_t x)
+{
+    if(x > _width)
+        return;
+
+    _Remap(_width + 1, _height, _sparse, x, 1, _height, 0);
+}
+
+void LayerTiles::DeleteRow(uint32_t y)
+{
+    if(y >= _height)
+        return;
+
+    _Remap(_width, _height - 1, _sparse, _width, 0, y, -1);
+}
+
+void LayerTiles::DeleteCol(uint32_t x)
+{
+    if(x >= _width)
+        return;
+
+    _Remap(_width - 1, _height, _sparse, x, -1, _height, 0);
+}
+
+void LayerTiles::_DetachChunk(std::shared_ptr<Chunk> &chunk)
+{
+    // Copy the chunk before writing when it is shared (e.g. the empty one).
+    if(chunk.use_count() > 1)
+        chunk = std::make_shared<Chunk>(*chunk);
+}
+
+void LayerTiles::_Allocate(uint32_t width, uint32_t height, bool sparse)
+{
+    _width = width;
+    _height = height;
+    _sparse = sparse;
+
+    _chunk_columns = (_width + LAYER_CHUNK_SIZE - 1) / LAYER_CHUNK_SIZE;
+    _chunk_rows = (_height + LAYER_CHUNK_SIZE - 1) / LAYER_CHUNK_SIZE;
+    _chunks.assign(_chunk_columns * _chunk_rows, _GetEmptyChunk());
+    if(_sparse)
+        return;
+
+    for(uint32_t i = 0; i < _chunks.size(); ++i)
+        _chunks[i] = std::make_shared<Chunk>(LAYER_CHUNK_SIZE * LAYER_CHUNK_SIZE, -1);
+}
+
+void LayerTiles::_Remap(uint32_t width, uint32_t height, bool sparse,
+                        uint32_t col, int32_t col_offset, uint32_t row, int32_t row_offset)
+{
+    LayerTiles tiles;
+    tiles._Allocate(width, height, sparse);
+
+    // Only walk the chunks holding tiles
+    for(uint32_t chunk_y = 0; chunk_y < GetChunkRows(); ++chunk_y) {
+        for(uint32_t chunk_x = 0; chunk_x < GetChunkColumns(); ++chunk_x) {
+            if(IsChunkEmpty(chunk_x, chunk_y))
+                continue;
+
+            uint32_t left = chunk_x * LAYER_CHUNK_SIZE;
+            uint32_t top = chunk_y * LAYER_CHUNK_SIZE;
+            uint32_t right = std::min(left + LAYER_CHUNK_SIZE, _width);
+            uint32_t bottom = std::min(top + LAYER_CHUNK_SIZE, _height);
+
+            for(uint32_t y = top; y < bottom; ++y) {
+                if(row_offset < 0 && y == row)
+                    continue;
+                uint32_t new_y = y >= row ? y + row_offset : y;
+                if(new_y >= height)
+                    continue;
+
+                for(uint32_t x = left; x < right; ++x) {
+                    if(col_offset < 0 && x == col)
+                        continue;
+                    uint32_t new_x = x >= col ? x + col_offset : x;
+                    if(new_x >= width)
+                        continue;
+
+                    int32_t tile_id = GetTile(x, y);
+                    if(tile_id != -1)
+                        tiles.SetTile(new_x, new_y, tile_id);
+                }
+            }
+        }
+    }
+
+    *this = std::move(tiles);
+}
+
+} // namespace vt_editor
@@ -0,0 +1,283 @@
+///////////////////////////////////////////////////////////////////////////////
+//            Copyright (C) 2004-2011 by The Allacrost Project
+//            Copyright (C) 2012-2015 by Bertram (Valyria Tear)
+//                         All Rights Reserved
+//
+// This code is licensed under the GNU GPL version 2. It is free software
+// and you may modify it and/or redistribute it under the terms of this license.
+// See http://www.gnu.org/copyleft/gpl.html for details.
+///////////////////////////////////////////////////////////////////////////////
+
+/** ***************************************************************************
+*** \file    layer.h
+*** \author  Yohann Ferreira, yohann ferreira orange fr
+*** \brief   Header file for the map tile layers data.
+*** **************************************************************************/
+
+#ifndef __LAYER_HEADER__
+#define __LAYER_HEADER__
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace vt_editor
+{
+
+//! \brief Different tile layers in the map.
+enum LAYER_TYPE {
+    INVALID_LAYER = -1,
+    GROUND_LAYER  =  0,
+    SKY_LAYER     =  1,
+    SELECT_LAYER  =  2,
+    TOTAL_LAYER   =  3
+};
+
+LAYER_TYPE &operator++(LAYER_TYPE &value, int dummy);
+
+LAYER_TYPE getLayerType(const std::string &type);
+std::string getTypeFromLayer(const LAYER_TYPE &type);
+
+//! \brief The width and height in tiles of the chunks storing the layers.
+const uint32_t LAYER_CHUNK_SIZE = 32;
+
+/** ***************************************************************************
+*** \brief The tile ids of a layer.
+***
+*** The tiles are stored in LAYER_CHUNK_SIZE x LAYER_CHUNK_SIZE chunks, row by row,
+*** in one of two ways:
+*** - Dense: every chunk is allocated along with the layer.
+*** - Sparse: the chunks all point to a shared empty chunk until a tile is written
+*** in them. This is meant for mostly empty layers, such as the sky ones.
+***
+*** -1 stands for an empty location. tiles[y][x] can still be used to read
+*** or write a tile, whatever the storage used.
+***
+*** Copies of a layer share the chunks until they are written, so that copying
+*** the layers of a map, e.g. for undoing a structural change, only costs one
+*** pointer copy per chunk. Writing a tile then only copies its chunk.
+*** **************************************************************************/
+class LayerTiles
+{
+public:
+    //! \brief Chunk storage, row by row.
+    typedef std::vector<int32_t> Chunk;
+
+    //! \brief Gives access to a tile through tiles[y][x].
+    class TileRef
+    {
+    public:
+        TileRef(LayerTiles &tiles, uint32_t x, uint32_t y):
+            _tiles(tiles), _x(x), _y(y)
+        {}
+
+        operator int32_t() const {
+            return _tiles.GetTile(_x, _y);
+        }
+        TileRef &operator=(int32_t tile_id) {
+            _tiles.SetTile(_x, _y, tile_id);
+            return *this;
+        }
+        TileRef &operator=(const TileRef &tile) {
+            _tiles.SetTile(_x, _y, static_cast<int32_t>(tile));
+            return *this;
+        }
+
+    private:
+        LayerTiles &_tiles;
+        uint32_t _x;
+        uint32_t _y;
+    };
+
+    //! \brief A row of tiles, as returned by tiles[y].
+    class RowRef
+    {
+    public:
+        RowRef(LayerTiles &tiles, uint32_t y):
+            _tiles(tiles), _y(y)
+        {}
+
+        TileRef operator[](uint32_t x) {
+            return TileRef(_tiles, x, _y);
+        }
+
+    private:
+        LayerTiles &_tiles;
+        uint32_t _y;
+    };
+
+    //! \brief A read-only row of tiles.
+    class ConstRowRef
+    {
+    public:
+        ConstRowRef(const LayerTiles &tiles, uint32_t y):
+            _tiles(tiles), _y(y)
+        {}
+
+        int32_t operator[](uint32_t x) const {
+            return _tiles.GetTile(x, _y);
+        }
+
+    private:
+        const LayerTiles &_tiles;
+        uint32_t _y;
+    };
+
+    LayerTiles():
+        _width(0),
+        _height(0),
+        _sparse(false),
+        _chunk_columns(0),
+        _chunk_rows(0)
+    {}
+
+    uint32_t GetWidth() const {
+        return _width;
+    }
+    uint32_t GetHeight() const {
+        return _height;
+    }
+
+    //! \brief Tells whether the tiles are stored in chunks.
+    bool IsSparse() const {
+        return _sparse;
+    }
+
+    //! \brief Changes the storage used, keeping the tiles.
+    void SetSparse(bool sparse);
+
+    int32_t GetTile(uint32_t x, uint32_t y) const {
+        return (*_chunks[(y / LAYER_CHUNK_SIZE) * _chunk_columns + x / LAYER_CHUNK_SIZE])
+               [(y % LAYER_CHUNK_SIZE) * LAYER_CHUNK_SIZE + x % LAYER_CHUNK_SIZE];
+    }
+    void SetTile(uint32_t x, uint32_t y, int32_t tile_id);
+
+    RowRef operator[](uint32_t y) {
+        return RowRef(*this, y);
+    }
+    ConstRowRef operator[](uint32_t y) const {
+        return ConstRowRef(*this, y);
+    }
+
+    //! \brief Copies the given row of tiles into row, resized to GetWidth().
+    void GetRow(uint32_t y, std::vector<int32_t> &row) const;
+    //! \brief Copies the given row of tiles into row, which must hold GetWidth() values.
+    void GetRow(uint32_t y, int32_t *row) const;
+
+    //! \brief Sets the given row of tiles. row must contain GetWidth() values.
+    //! Only the chunks whose tiles change are copied, or allocated on sparse layers.
+    void SetRow(uint32_t y, const std::vector<int32_t> &row);
+    void SetRow(uint32_t y, const int32_t *row);
+
+    //! \brief Keeps the chunk storage only when at most half of the chunks hold tiles.
+    void OptimizeStorage();
+
+    //! \brief The chunk grid size, and whether a chunk contains no tile at all.
+    //! The chunks of dense layers are never seen as empty.
+    //@{
+    uint32_t GetChunkColumns() const {
+        return _chunk_columns;
+    }
+    uint32_t GetChunkRows() const {
+        return _chunk_rows;
+    }
+    bool IsChunkEmpty(uint32_t chunk_x, uint32_t chunk_y) const {
+        return _chunks[chunk_y * _chunk_columns + chunk_x] == _GetEmptyChunk();
+    }
+    //@}
+
+    //! \brief Tells how many chunks hold tiles. All of them on dense layers.
+    uint32_t GetUsedChunkCount() const;
+
+    //! \brief Resizes the layer, keeping the tiles still within the new size.
+    //! The new locations are empty.
+    void Resize(uint32_t width, uint32_t height);
+
+    //! \brief Fills the layer with the given tile id.
+    void Fill(int32_t tile_id = -1);
+
+    //! \brief Inserts an empty row/column before the given one, or deletes it.
+    //@{
+    void InsertRow(uint32_t y);
+    void InsertCol(uint32_t x);
+    void DeleteRow(uint32_t y);
+    void DeleteCol(uint32_t x);
+    //@}
+
+private:
+    //! \brief The layer size in tiles.
+    uint32_t _width;
+    uint32_t _height;
+
+    //! \brief Whether the tiles are stored in chunks.
+    bool _sparse;
+
+    //! \brief The chunks, row by row, and the chunk grid size.
+    //! Chunks shared with another layer or the empty one are copied before being written.
+    std::vector<std::shared_ptr<Chunk> > _chunks;
+    uint32_t _chunk_columns;
+    uint32_t _chunk_rows;
+
+    //! \brief The chunk shared by all the empty locations of sparse layers.
+    static const std::shared_ptr<Chunk>& _GetEmptyChunk();
+
+    //! \brief Copies the given chunk when it is shared, before writing it.
+    static void _DetachChunk(std::shared_ptr<Chunk> &chunk);
+
+    //! \brief Sets the layer size and storage, with only empty tiles.
+    void _Allocate(uint32_t width, uint32_t height, bool sparse);
+
+    /** \brief Moves the tiles to a new storage of the given size and kind.
+    ***
+    *** When offset is 1, the tiles at or after the given column (or row) are moved
+    *** to the next one. When offset is -1, the tiles on it are dropped and the ones
+    *** after it are moved to the previous one. 0 keeps the tiles in place.
+    *** The tiles not fitting in the new size are dropped.
+    **/
+    void _Remap(uint32_t width, uint32_t height, bool sparse,
+                uint32_t col, int32_t col_offset, uint32_t row, int32_t row_offset);
+};
+
+// A simplified struct used to pass everything but the tiles info
+struct LayerInfo {
+    std::string name;
+    LAYER_TYPE layer_type;
+    // Whether the tiles are stored in chunks, see LayerTiles.
+    bool sparse;
+
+    LayerInfo() {
+        layer_type = GROUND_LAYER;
+        sparse = false;
+    }
+};
+
+class Layer
+{
+public:
+    std::string name;
+    LAYER_TYPE layer_type;
+    // Represents the tile indeces: i.e: tiles[y][x] = tile_id at (x,y)
+    LayerTiles tiles;
+    // Tells whether the layer is currently visible.
+    bool visible;
+
+    Layer() {
+        layer_type = GROUND_LAYER;
+        visible = true;
+    }
+
+    // Resize a layer to the given map size
+    void Resize(uint32_t width, uint32_t height) {
+        tiles.Resize(width, height);
+    }
+
+    // Fill a layer with the given tile index value.
+    void Fill(int32_t tile_id = -1) {
+        tiles.Fill(tile_id);
+    }
+};
+
+} // namespace vt_editor
+
+#endif // __LAYER_HEADER__
@@ -0,0 +1,195 @@
+///////////////////////////////////////////////////////////////////////////////
+//            Copyright (C) 2004-2011 by The Allacrost Project
+//            Copyright (C) 2012-2015 by Bertram (Valyria Tear)
+//                         All Rights Reserved
+//
+// This code is licensed under the GNU GPL version 2. It is free software
+// and you may modify it and/or redistribute it under the terms of this license.
+// See http://www.gnu.org/copyleft/gpl.html for details.
+///////////////////////////////////////////////////////////////////////////////
+
+/** ***************************************************************************
+*** \file    map_writer.cpp
+*** \author  Yohann Ferreira, yohann ferreira orange fr
+*** \brief   Source file for the buffered map file writer.
+*** **************************************************************************/
+
+#include "map_writer.h"
+
+namespace vt_editor
+{
+
+MapWriter::MapWriter() :
+    _write_ok(true)
+{}
+
+MapWriter::~MapWriter()
+{
+    if(_file.isOpen())
+        CloseFile();
+}
+
+bool MapWriter::OpenFile(const QString &filename)
+{
+    _file.setFileName(filename);
+    // Text mode writes the same line endings as the standard file streams.
+    // The data is already buffered here.
+    if(!_file.open(QIODevice::WriteOnly | QIODevice::Truncate |
+                   QIODevice::Text | QIODevice::Unbuffered))
+        return false;
+
+    _buffer.clear();
+    _buffer.reserve(FLUSH_SIZE + 64 * 1024);
+    _table_path.clear();
+    _table_path_sizes.clear();
+    _write_ok = true;
+    return true;
+}
+
+bool MapWriter::CloseFile()
+{
+    _Flush(true);
+    _file.close();
+    _buffer = std::vector<char>();
+    _table_path_sizes.clear();
+    _table_path.clear();
+    return _write_ok;
+}
+
+void MapWriter::InsertNewLine()
+{
+    _Append('\n');
+}
+
+void MapWriter::WriteComment(const std::string &comment)
+{
+    _Append("-- ", 3);
+    _Append(comment);
+    _Append('\n');
+}
+
+void MapWriter::BeginTable(const std::string &key)
+{
+    _WriteKey(key);
+    _Append(" = {}\n", 6);
+
+    _table_path_sizes.push_back(_table_path.size());
+    if(!_table_path.empty())
+        _table_path += '.';
+    _table_path += key;
+}
+
+void MapWriter::BeginTable(int32_t key)
+{
+    _WriteKey(key);
+    _Append(" = {}\n", 6);
+
+    _table_path_sizes.push_back(_table_path.size());
+    _table_path += '[';
+    _table_path += std::to_string(key);
+    _table_path += ']';
+}
+
+void MapWriter::EndTable()
+{
+    if(_table_path_sizes.empty())
+        return;
+
+    _table_path.resize(_table_path_sizes.back());
+    _table_path_sizes.pop_back();
+}
+
+void MapWriter::WriteInt(const std::string &key, int32_t value)
+{
+    _WriteKey(key);
+    _Append(" = ", 3);
+    _AppendInt(value);
+    _Append('\n');
+    _Flush();
+}
+
+void MapWriter::WriteString(const std::string &key, const std::string &value)
+{
+    _WriteKey(key);
+    _Append(" = \"", 4);
+    _Append(value);
+    _Append("\"\n", 2);
+    _Flush();
+}
+
+void MapWriter::WriteString(int32_t key, const std::string &value)
+{
+    _WriteKey(key);
+    _Append(" = \"", 4);
+    _Append(value);
+    _Append("\"\n", 2);
+    _Flush();
+}
+
+void MapWriter::WriteIntVector(int32_t key, const int32_t *values, uint32_t count)
+{
+    _WriteKey(key);
+    _Append(" = { ", 5);
+    for(uint32_t i = 0; i < count; ++i) {
+        if(i > 0)
+            _Append(", ", 2);
+        _AppendInt(values[i]);
+    }
+    _Append(" }\n", 3);
+    _Flush();
+}
+
+void MapWriter::_WriteKey(const std::string &key)
+{
+    if(!_table_path.empty()) {
+        _Append(_table_path);
+        _Append('.');
+    }
+    _Append(key);
+}
+
+void MapWriter::_WriteKey(int32_t key)
+{
+    _Append(_table_path);
+    _Append('[');
+    _AppendInt(key);
+    _Append(']');
+}
+
+void MapWriter::_AppendInt(int32_t value)
+{
+    // Empty tiles are by far the most common value
+    if(value == -1) {
+        _Append("-1", 2);
+        return;
+    }
+
+    // Digits are written from the end. Working on the unsigned value
+    // handles the lowest int32_t as well.
+    char digits[12];
+    char *end = digits + sizeof(digits);
+    char *begin = end;
+    uint32_t number = value < 0 ? 0u - static_cast<uint32_t>(value) : static_cast<uint32_t>(value);
+    do {
+        *--begin = static_cast<char>('0' + number % 10);
+        number /= 10;
+    } while(number != 0);
+
+    if(value < 0)
+        *--begin = '-';
+
+    _Append(begin, end - begin);
+}
+
+void MapWriter::_Flush(bool force)
+{
+    if(_buffer.empty() || (!force && _buffer.size() < FLUSH_SIZE))
+        return;
+
+    qint64 size = static_cast<qint64>(_buffer.size());
+    if(_file.write(_buffer.data(), size) != size)
+        _write_ok = false;
+    _buffer.clear();
+}
+
+} // namespace vt_editor
@@ -0,0 +1,104 @@
+///////////////////////////////////////////////////////////////////////////////
+//            Copyright (C) 2004-2011 by The Allacrost Project
+//            Copyright (C) 2012-2015 by Bertram (Valyria Tear)
+//                         All Rights Reserved
+//
+// This code is licensed under the GNU GPL version 2. It is free software
+// and you may modify it and/or redistribute it under the terms of this license.
+// See http://www.gnu.org/copyleft/gpl.html for details.
+///////////////////////////////////////////////////////////////////////////////
+
+/** ***************************************************************************
+*** \file    map_writer.h
+*** \author  Yohann Ferreira, yohann ferreira orange fr
+*** \brief   Header file for the buffered map file writer.
+*** **************************************************************************/
+
+#ifndef __MAP_WRITER_HEADER__
+#define __MAP_WRITER_HEADER__
+
+#include <QFile>
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace vt_editor
+{
+
+/** ***************************************************************************
+*** \brief Writes map Lua files in the same format as vt_script::WriteScriptDescriptor.
+***
+*** The text is formatted directly into a large memory buffer which is written
+*** to the file only when full, so that saving the big integer tables of a map
+*** costs a few write calls instead of one stream operation per value.
+***
+*** Only the subset of the WriteScriptDescriptor functions used by map files
+*** is provided.
+*** **************************************************************************/
+class MapWriter
+{
+public:
+    MapWriter();
+
+    ~MapWriter();
+
+    bool OpenFile(const QString &filename);
+
+    //! \brief Writes the remaining buffered text and closes the file.
+    //! \return False if any write operation failed.
+    bool CloseFile();
+
+    void InsertNewLine();
+    void WriteComment(const std::string &comment);
+
+    void BeginTable(const std::string &key);
+    void BeginTable(int32_t key);
+    void EndTable();
+
+    void WriteInt(const std::string &key, int32_t value);
+    void WriteString(const std::string &key, const std::string &value);
+    void WriteString(int32_t key, const std::string &value);
+
+    //! \brief Writes the count values found in values as "[key] = { v1, v2, ... }".
+    void WriteIntVector(int32_t key, const int32_t *values, uint32_t count);
+
+private:
+    //! \brief The buffer size triggering a write to the file.
+    static const uint32_t FLUSH_SIZE = 4 * 1024 * 1024;
+
+    QFile _file;
+
+    //! \brief The text not written to the file yet.
+    std::vector<char> _buffer;
+
+    //! \brief The current table path, e.g.: map_data.layers[0]
+    std::string _table_path;
+    //! \brief The table path length before each of the opened tables.
+    std::vector<size_t> _table_path_sizes;
+
+    //! \brief False once a write operation failed.
+    bool _write_ok;
+
+    //! \brief Writes the text preceding a key in the current table.
+    void _WriteKey(const std::string &key);
+    void _WriteKey(int32_t key);
+
+    void _Append(const char *text, size_t length) {
+        _buffer.insert(_buffer.end(), text, text + length);
+    }
+    void _Append(const std::string &text) {
+        _Append(text.data(), text.size());
+    }
+    void _Append(char character) {
+        _buffer.push_back(character);
+    }
+    void _AppendInt(int32_t value);
+
+    //! \brief Writes the buffer to the file once it is big enough, or always when forced.
+    void _Flush(bool force = false);
+};
+
+} // namespace vt_editor
+
+#endif // __MAP_WRITER_HEADER__
@@ -0,0 +1,323 @@
+///////////////////////////////////////////////////////////////////////////////
+//            Copyright (C) 2004-2011 by The Allacrost Project
+//            Copyright (C) 2012-2015 by Bertram (Valyria Tear)
+//                         All Rights Reserved
+//
+// This code is licensed under the GNU GPL version 2. It is free software
+// and you may modify it and/or redistribute it under the terms of this license.
+// See http://www.gnu.org/copyleft/gpl.html for details.
+///////////////////////////////////////////////////////////////////////////////
+
+/** ***************************************************************************
+*** \file    tile_delta.cpp
+*** \author  Yohann Ferreira, yohann ferreira orange fr
+*** \brief   Source file for the compact tile changes used by the undo commands.
+*** **************************************************************************/
+
+#include "tile_delta.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace vt_editor
+{
+
+TileDelta::TileDelta(const std::vector<QPoint> &indeces, const std::vector<int32_t> &previous,
+                     const std::vector<int32_t> &modified) :
+    _tile_count(0)
+{
+    uint32_t count = std::min(indeces.size(), std::min(previous.size(), modified.size()));
+    if(count == 0)
+        return;
+
+    for(uint32_t i = 0; i < count; ++i)
+        _area |= QRect(indeces[i], QSize(1, 1));
+
+    // Sort the changes by tile offset. The changes of a tile stay in the
+    // order they were done since the pairs are then sorted by change index.
+    std::vector<std::pair<uint32_t, uint32_t> > changes(count);
+    for(uint32_t i = 0; i < count; ++i) {
+        uint32_t offset = (indeces[i].y() - _area.top()) * _area.width() + indeces[i].x() - _area.left();
+        changes[i] = std::make_pair(offset, i);
+    }
+    std::sort(changes.begin(), changes.end());
+
+    for(uint32_t i = 0; i < count;) {
+        uint32_t offset = changes[i].first;
+        int32_t previous_value = previous[changes[i].second];
+        // Skip to the last change of this tile
+        while(i + 1 < count && changes[i + 1].first == offset)
+            ++i;
+        int32_t modified_value = modified[changes[i].second];
+        ++i;
+
+        _AppendTile(offset, previous_value, modified_value);
+    }
+
+    _spans.shrink_to_fit();
+    _previous_runs.shrink_to_fit();
+    _modified_runs.shrink_to_fit();
+}
+
+void TileDelta::Merge(const TileDelta &next)
+{
+    if(next.IsEmpty())
+        return;
+    if(IsEmpty()) {
+        *this = next;
+        return;
+    }
+
+    // Both deltas are decoded row by row, so they're merged in a single pass
+    // without sorting their changes again.
+    std::vector<QPoint> indeces;
+    std::vector<int32_t> previous;
+    std::vector<int32_t> modified;
+    _Decode(indeces, previous, modified);
+    std::vector<QPoint> next_indeces;
+    std::vector<int32_t> next_previous;
+    std::vector<int32_t> next_modified;
+    next._Decode(next_indeces, next_previous, next_modified);
+
+    TileDelta merged;
+    merged._area = _area | next._area;
+    uint32_t i = 0;
+    uint32_t j = 0;
+    while(i < indeces.size() || j < next_indeces.size()) {
+        // Compares the tiles row by row, -1 meaning this delta tile comes first
+        int32_t order = 0;
+        if(j == next_indeces.size())
+            order = -1;
+        else if(i == indeces.size())
+            order = 1;
+        else if(indeces[i].y() != next_indeces[j].y())
+            order = indeces[i].y() < next_indeces[j].y() ? -1 : 1;
+        else if(indeces[i].x() != next_indeces[j].x())
+            order = indeces[i].x() < next_indeces[j].x() ? -1 : 1;
+
+        const QPoint &index = order > 0 ? next_indeces[j] : indeces[i];
+        uint32_t offset = (index.y() - merged._area.top()) * merged._area.width() + index.x() - merged._area.left();
+        // The tiles found in both keep the previous value of this delta
+        // and the modified value of the next one.
+        if(order < 0) {
+            merged._AppendTile(offset, previous[i], modified[i]);
+            ++i;
+        }
+        else if(order > 0) {
+            merged._AppendTile(offset, next_previous[j], next_modified[j]);
+            ++j;
+        }
+        else {
+            merged._AppendTile(offset, previous[i], next_modified[j]);
+            ++i;
+            ++j;
+        }
+    }
+
+    merged._spans.shrink_to_fit();
+    merged._previous_runs.shrink_to_fit();
+    merged._modified_runs.shrink_to_fit();
+    *this = std::move(merged);
+}
+
+QRect TileDelta::Apply(LayerTiles &tiles, bool undo) const
+{
+    QRect changed_area;
+    const std::vector<int32_t> &runs = undo ? _previous_runs : _modified_runs;
+    uint32_t run_index = 0;
+    int32_t run_left = runs.empty() ? 0 : runs[0];
+
+    for(uint32_t span_index = 0; span_index < _spans.size(); span_index += 2) {
+        uint32_t offset = _spans[span_index];
+        uint32_t end = offset + _spans[span_index + 1];
+        for(; offset < end; ++offset) {
+            // Move to the next run once the current one is used
+            if(run_left == 0) {
+                run_index += 2;
+                run_left = runs[run_index];
+            }
+            --run_left;
+
+            uint32_t x = _area.left() + offset % _area.width();
+            uint32_t y = _area.top() + offset / _area.width();
+            if(x >= tiles.GetWidth() || y >= tiles.GetHeight())
+                continue;
+
+            int32_t value = runs[run_index + 1];
+            if(tiles[y][x] != value) {
+                tiles[y][x] = value;
+                changed_area |= QRect(x, y, 1, 1);
+            }
+        }
+    }
+
+    return changed_area;
+}
+
+void TileDelta::Clear()
+{
+    _area = QRect();
+    _tile_count = 0;
+    std::vector<uint32_t>().swap(_spans);
+    std::vector<int32_t>().swap(_previous_runs);
+    std::vector<int32_t>().swap(_modified_runs);
+}
+
+void TileDelta::Write(QDataStream &stream) const
+{
+    stream << static_cast<qint32>(_area.x()) << static_cast<qint32>(_area.y())
+           << static_cast<qint32>(_area.width()) << static_cast<qint32>(_area.height());
+
+    stream << static_cast<quint32>(_spans.size());
+    for(uint32_t i = 0; i < _spans.size(); ++i)
+        stream << static_cast<quint32>(_spans[i]);
+
+    stream << static_cast<quint32>(_previous_runs.size());
+    for(uint32_t i = 0; i < _previous_runs.size(); ++i)
+        stream << static_cast<qint32>(_previous_runs[i]);
+
+    stream << static_cast<quint32>(_modified_runs.size());
+    for(uint32_t i = 0; i < _modified_runs.size(); ++i)
+        stream << static_cast<qint32>(_modified_runs[i]);
+}
+
+bool TileDelta::Read(QDataStream &stream)
+{
+    Clear();
+
+    qint32 x = 0;
+    qint32 y = 0;
+    qint32 width = 0;
+    qint32 height = 0;
+    stream >> x >> y >> width >> height;
+    if(x < 0 || y < 0 || width < 0 || height < 0)
+        return false;
+
+    // Each value takes 4 bytes, this checks the sizes before allocating anything.
+    std::vector<uint32_t> spans;
+    std::vector<int32_t> previous_runs;
+    std::vector<int32_t> modified_runs;
+    quint32 size = 0;
+    stream >> size;
+    if(stream.status() != QDataStream::Ok || size % 2 != 0 || size > stream.device()->bytesAvailable() / 4)
+        return false;
+    spans.resize(size);
+    for(uint32_t i = 0; i < size; ++i) {
+        quint32 value = 0;
+        stream >> value;
+        spans[i] = value;
+    }
+
+    stream >> size;
+    if(stream.status() != QDataStream::Ok || size % 2 != 0 || size > stream.device()->bytesAvailable() / 4)
+        return false;
+    previous_runs.resize(size);
+    for(uint32_t i = 0; i < size; ++i) {
+        qint32 value = 0;
+        stream >> value;
+        previous_runs[i] = value;
+    }
+
+    stream >> size;
+    if(stream.status() != QDataStream::Ok || size % 2 != 0 || size > stream.device()->bytesAvailable() / 4)
+        return false;
+    modified_runs.resize(size);
+    for(uint32_t i = 0; i < size; ++i) {
+        qint32 value = 0;
+        stream >> value;
+        modified_runs[i] = value;
+    }
+
+    if(stream.status() != QDataStream::Ok)
+        return false;
+
+    // The spans must stay in the area, and the runs must hold one value per tile.
+    int64_t tile_count = 0;
+    int64_t area_size = static_cast<int64_t>(width) * height;
+    for(uint32_t i = 0; i < spans.size(); i += 2) {
+        if(spans[i + 1] == 0 || static_cast<int64_t>(spans[i]) + spans[i + 1] > area_size)
+            return false;
+        tile_count += spans[i + 1];
+    }
+    if(_GetValueCount(previous_runs) != tile_count || _GetValueCount(modified_runs) != tile_count)
+        return false;
+
+    _area = QRect(x, y, width, height);
+    _tile_count = static_cast<uint32_t>(tile_count);
+    _spans.swap(spans);
+    _previous_runs.swap(previous_runs);
+    _modified_runs.swap(modified_runs);
+    return true;
+}
+
+void TileDelta::_Decode(std::vector<QPoint> &indeces, std::vector<int32_t> &previous,
+                        std::vector<int32_t> &modified) const
+{
+    uint32_t previous_index = 0;
+    int32_t previous_left = _previous_runs.empty() ? 0 : _previous_runs[0];
+    uint32_t modified_index = 0;
+    int32_t modified_left = _modified_runs.empty() ? 0 : _modified_runs[0];
+
+    for(uint32_t span_index = 0; span_index < _spans.size(); span_index += 2) {
+        uint32_t offset = _spans[span_index];
+        uint32_t end = offset + _spans[span_index + 1];
+        for(; offset < end; ++offset) {
+            if(previous_left == 0) {
+                previous_index += 2;
+                previous_left = _previous_runs[previous_index];
+            }
+            --previous_left;
+            if(modified_left == 0) {
+                modified_index += 2;
+                modified_left = _modified_runs[modified_index];
+            }
+            --modified_left;
+
+            indeces.push_back(QPoint(_area.left() + offset % _area.width(),
+                                     _area.top() + offset / _area.width()));
+            previous.push_back(_previous_runs[previous_index + 1]);
+            modified.push_back(_modified_runs[modified_index + 1]);
+        }
+    }
+}
+
+void TileDelta::_AppendTile(uint32_t offset, int32_t previous, int32_t modified)
+{
+    // Extend the last span when the tile follows it
+    uint32_t spans_size = _spans.size();
+    if(spans_size > 0 && _spans[spans_size - 2] + _spans[spans_size - 1] == offset) {
+        ++_spans[spans_size - 1];
+    }
+    else {
+        _spans.push_back(offset);
+        _spans.push_back(1);
+    }
+    ++_tile_count;
+
+    _AppendValue(_previous_runs, previous);
+    _AppendValue(_modified_runs, modified);
+}
+
+void TileDelta::_AppendValue(std::vector<int32_t> &runs, int32_t value)
+{
+    uint32_t runs_size = runs.size();
+    if(runs_size > 0 && runs[runs_size - 1] == value) {
+        ++runs[runs_size - 2];
+        return;
+    }
+    runs.push_back(1);
+    runs.push_back(value);
+}
+
+int64_t TileDelta::_GetValueCount(const std::vector<int32_t> &runs)
+{
+    int64_t count = 0;
+    for(uint32_t i = 0; i < runs.size(); i += 2) {
+        if(runs[i] <= 0)
+            return -1;
+        count += runs[i];
+    }
+    return count;
+}
+
+} // namespace vt_editor
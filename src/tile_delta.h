@@ -0,0 +1,125 @@
+///////////////////////////////////////////////////////////////////////////////
+//            Copyright (C) 2004-2011 by The Allacrost Project
+//            Copyright (C) 2012-2015 by Bertram (Valyria Tear)
+//                         All Rights Reserved
+//
+// This code is licensed under the GNU GPL version 2. It is free software
+// and you may modify it and/or redistribute it under the terms of this license.
+// See http://www.gnu.org/copyleft/gpl.html for details.
+///////////////////////////////////////////////////////////////////////////////
+
+/** ***************************************************************************
+*** \file    tile_delta.h
+*** \author  Yohann Ferreira, yohann ferreira orange fr
+*** \brief   Header file for the compact tile changes used by the undo commands.
+*** **************************************************************************/
+
+#ifndef __TILE_DELTA_HEADER__
+#define __TILE_DELTA_HEADER__
+
+#include "layer.h"
+
+#include <QDataStream>
+#include <QPoint>
+#include <QRect>
+
+#include <vector>
+#include <stdint.h>
+
+namespace vt_editor
+{
+
+/** ***************************************************************************
+*** \brief The tiles modified by an edit of one layer, compactly encoded.
+***
+*** Only the value of each tile before and after the edit is kept, once per
+*** tile even if the edit modified it several times. The modified tiles are
+*** stored as spans of consecutive tiles, row by row within the bounding
+*** rectangle of the edit, and their values are run-length encoded. Filling an
+*** area with one tile thus costs a few integers per row of the area.
+*** **************************************************************************/
+class TileDelta
+{
+public:
+    TileDelta():
+        _tile_count(0)
+    {}
+
+    /** \brief Encodes the tile changes: the tile at indeces[i] went from
+    *** previous[i] to modified[i]. When a tile is found several times, its
+    *** first previous value and last modified value are kept.
+    **/
+    TileDelta(const std::vector<QPoint> &indeces, const std::vector<int32_t> &previous,
+              const std::vector<int32_t> &modified);
+
+    /** \brief Adds the changes of a later edit of the same layer, as if both edits
+    *** were done at once. The tiles found in both keep their value before this
+    *** edit and after the later one. This takes a time linear in the number of
+    *** tiles of both deltas.
+    **/
+    void Merge(const TileDelta &next);
+
+    /** \brief Sets the tiles to their modified values, or to their previous ones when undoing.
+    *** \return The bounding rectangle of the tiles whose value actually changed.
+    **/
+    QRect Apply(LayerTiles &tiles, bool undo) const;
+
+    //! \brief The bounding rectangle of the modified tiles, empty when none were.
+    const QRect &GetArea() const {
+        return _area;
+    }
+
+    bool IsEmpty() const {
+        return _spans.empty();
+    }
+
+    //! \brief The number of modified tiles.
+    uint32_t GetTileCount() const {
+        return _tile_count;
+    }
+
+    //! \brief Drops the changes and frees their memory.
+    void Clear();
+
+    //! \brief Writes the encoded changes, as used by the undo journal.
+    void Write(QDataStream &stream) const;
+
+    //! \brief Reads changes written by Write().
+    //! \return False when the data read isn't valid. The delta is then empty.
+    bool Read(QDataStream &stream);
+
+private:
+    //! \brief The bounding rectangle of the modified tiles.
+    QRect _area;
+
+    //! \brief Pairs of (first tile offset, tile count) for each span of consecutive
+    //! modified tiles. The offsets are counted row by row within _area.
+    std::vector<uint32_t> _spans;
+
+    //! \brief The number of tiles of all the spans.
+    uint32_t _tile_count;
+
+    //! \brief Pairs of (count, tile id) giving the tile values, in the spans order.
+    //{@
+    std::vector<int32_t> _previous_runs;
+    std::vector<int32_t> _modified_runs;
+    //@}
+
+    //! \brief Appends the decoded changes to the given vectors.
+    void _Decode(std::vector<QPoint> &indeces, std::vector<int32_t> &previous,
+                 std::vector<int32_t> &modified) const;
+
+    //! \brief Appends the change of the tile at the given offset within _area,
+    //! which must come after the tiles already appended.
+    void _AppendTile(uint32_t offset, int32_t previous, int32_t modified);
+
+    //! \brief Appends a value to the run-length encoded values.
+    static void _AppendValue(std::vector<int32_t> &runs, int32_t value);
+
+    //! \brief Returns the number of values found in the runs, or -1 if a count isn't positive.
+    static int64_t _GetValueCount(const std::vector<int32_t> &runs);
+};
+
+} // namespace vt_editor
+
+#endif // __TILE_DELTA_HEADER__
@@ -22,15 +22,30 @@
 #include "script/script_read.h"
 #include "script/script_write.h"
 
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFileInfo>
 #include <QHeaderView>
 #include <QFile>
 #include <QImage>
+#include <QPainter>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include <algorithm>
 
 using namespace vt_script;
 
 const uint32_t num_rows = 16;
 const uint32_t num_cols = 16;
 
+const quint32 IMAGE_CACHE_MAGIC = 0x56544943; // "VTIC"
+const quint32 IMAGE_CACHE_VERSION = 2;
+//! \brief The pixels are stored right after the header, at this offset.
+const qint64 IMAGE_CACHE_HEADER_SIZE = 48;
+
 namespace vt_editor
 {
 
@@ -40,12 +55,13 @@ namespace vt_editor
 
 Tileset::Tileset() :
     _initialized(false)
-{} // Tileset constructor
+{
+    std::fill(_walkability_masks, _walkability_masks + 256, 0);
+} // Tileset constructor
 
 
 Tileset::~Tileset()
 {
-    tiles.clear();
 } // Tileset destructor
 
 
@@ -59,7 +75,7 @@ QString Tileset::CreateTilesetName(const QString &filename)
     return tname;
 }
 
-bool Tileset::New(const QString &img_filename, const QString& root_folder, bool one_image)
+bool Tileset::New(const QString &img_filename, const QString& root_folder)
 {
     if (img_filename.isEmpty())
         return false;
@@ -81,39 +97,11 @@ bool Tileset::New(const QString &img_filename, const QString& root_folder, bool
 
     _tileset_image_filename = "data/tilesets/" + _tileset_name + img_filename.mid(img_filename.length() - 4, 4);
 
-    // Prepare the tile vector and load the tileset image
-    tiles.clear();
-    tiles.resize(256);
-
-    QRect rectangle;
-    QImage entire_tileset;
-    QString tileset_full_path = root_folder + _tileset_image_filename;
-    if (!entire_tileset.load(tileset_full_path, "png")) {
-        qDebug("Failed to load tileset image: %s",
-                tileset_full_path.toStdString().c_str());
+    // Load the tileset image
+    QImage image = DecodeImage(root_folder + _tileset_image_filename);
+    if (image.isNull())
         return false;
-    }
-
-    if (one_image) {
-        tiles[0].convertFromImage(entire_tileset);
-    }
-    else {
-
-        for(uint32_t row = 0; row < num_rows; ++row) {
-            for(uint32_t col = 0; col < num_cols; ++col) {
-                rectangle.setRect(col * TILE_WIDTH, row * TILE_HEIGHT, TILE_WIDTH,
-                                TILE_HEIGHT);
-                QImage tile = entire_tileset.copy(rectangle);
-                if(!tile.isNull()) {
-                    // linearize the tile index
-                    uint32_t i = num_rows * row + col;
-                    tiles[i].convertFromImage(tile);
-                } else {
-                    qDebug("Image loading error!");
-                }
-            }
-        }
-    }
+    SetImage(image);
 
     // Initialize the rest of the tileset data
     std::vector<int32_t> blank_entry(4, 0);
@@ -123,13 +111,28 @@ bool Tileset::New(const QString &img_filename, const QString& root_folder, bool
 
     autotileability.clear();
     _animated_tiles.clear();
+    UpdateWalkabilityMasks();
 
     _initialized = true;
     return true;
 } // Tileset::New(...)
 
 
-bool Tileset::Load(const QString &def_filename, const QString& root_folder, bool one_image)
+bool Tileset::Load(const QString &def_filename, const QString& root_folder)
+{
+    if (!LoadDefinition(def_filename, root_folder))
+        return false;
+
+    QImage image = DecodeImage(root_folder + _tileset_image_filename);
+    if (image.isNull())
+        return false;
+
+    SetImage(image);
+    return true;
+} // Tileset::Load(...)
+
+
+bool Tileset::LoadDefinition(const QString &def_filename, const QString& root_folder)
 {
     if (def_filename.isEmpty())
         return false;
@@ -160,40 +163,6 @@ bool Tileset::Load(const QString &def_filename, const QString& root_folder, bool
 
     _tileset_image_filename = QString::fromStdString(read_data.ReadString("image"));
 
-    // Prepare the tile vector and load the tileset image
-    tiles.clear();
-    tiles.resize(256);
-
-    QRect rectangle;
-    QImage entire_tileset;
-    QString tileset_full_path = root_folder + _tileset_image_filename;
-    if (!entire_tileset.load(tileset_full_path, "png")) {
-        qDebug("Failed to load tileset image: %s",
-                tileset_full_path.toStdString().c_str());
-        return false;
-    }
-
-    if (one_image) {
-        tiles[0].convertFromImage(entire_tileset);
-    }
-    else {
-
-        for(uint32_t row = 0; row < num_rows; ++row) {
-            for(uint32_t col = 0; col < num_cols; ++col) {
-                rectangle.setRect(col * TILE_WIDTH, row * TILE_HEIGHT, TILE_WIDTH,
-                                TILE_HEIGHT);
-                QImage tile = entire_tileset.copy(rectangle);
-                if(!tile.isNull()) {
-                    // linearize the tile index
-                    uint32_t i = num_rows * row + col;
-                    tiles[i].convertFromImage(tile);
-                } else {
-                    qDebug("Image loading error!");
-                }
-            }
-        }
-    }
-
     // Read in autotiling information.
     if(read_data.DoesTableExist("autotiling") == true) {
         // Contains the keys (indeces, if you will) of this table's entries
@@ -233,6 +202,7 @@ bool Tileset::Load(const QString &def_filename, const QString& root_folder, bool
         } // iterate through all rows of the walkability table
         read_data.CloseTable();
     } // make sure table exists first
+    UpdateWalkabilityMasks();
 
     // Read in animated tiles.
     if(read_data.DoesTableExist("animated_tiles") == true) {
@@ -260,9 +230,164 @@ bool Tileset::Load(const QString &def_filename, const QString& root_folder, bool
     read_data.CloseTable();
     read_data.CloseFile();
 
-    _initialized = true;
+    // The tileset is initialized once its image is set.
     return true;
-} // Tileset::Load(...)
+} // Tileset::LoadDefinition(...)
+
+
+QImage Tileset::DecodeImage(const QString &img_filename)
+{
+    QFileInfo image_info(img_filename);
+    QString cache_filename = _GetImageCacheFilename(img_filename);
+    QImage image = _LoadImageCache(cache_filename, image_info);
+    if (!image.isNull())
+        return image;
+
+    if (!image.load(img_filename, "png")) {
+        qDebug("Failed to load tileset image: %s",
+                img_filename.toStdString().c_str());
+        return image;
+    }
+
+    // Done here rather than when creating the atlas, as it can be costly.
+    image = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    _SaveImageCache(cache_filename, image_info, image);
+    return image;
+} // Tileset::DecodeImage(...)
+
+
+QString Tileset::_GetImageCacheFilename(const QString &img_filename)
+{
+    QFileInfo image_info(img_filename);
+    if (!image_info.exists())
+        return QString();
+
+    QString cache_folder = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    if (cache_folder.isEmpty())
+        return QString();
+
+    // A modified image replaces the cache file of its previous version.
+    QByteArray hash = QCryptographicHash::hash(image_info.absoluteFilePath().toUtf8(),
+                                               QCryptographicHash::Sha1);
+    return cache_folder + "/tilesets/" + QString::fromLatin1(hash.toHex()) + ".atlas";
+}
+
+
+//! \brief Unmaps the cache file memory once the image using it is destroyed.
+static void UnmapImageCache(void *cache_file)
+{
+    delete static_cast<QFile *>(cache_file);
+}
+
+
+QImage Tileset::_LoadImageCache(const QString &cache_filename, const QFileInfo &image_info)
+{
+    if (cache_filename.isEmpty())
+        return QImage();
+
+    QFile *cache_file = new QFile(cache_filename);
+    if (!cache_file->open(QIODevice::ReadOnly)) {
+        delete cache_file;
+        return QImage();
+    }
+
+    QDataStream stream(cache_file);
+    stream.setVersion(QDataStream::Qt_5_0);
+
+    quint32 magic = 0;
+    quint32 version = 0;
+    qint32 byte_order = -1;
+    qint64 image_size = -1;
+    qint64 image_modified = -1;
+    qint32 width = 0;
+    qint32 height = 0;
+    qint32 bytes_per_line = 0;
+    qint32 format = QImage::Format_Invalid;
+    stream >> magic >> version >> byte_order >> image_size >> image_modified
+           >> width >> height >> bytes_per_line >> format;
+
+    // The pixels are stored as they are in memory
+    qint64 data_size = static_cast<qint64>(bytes_per_line) * height;
+    if (stream.status() != QDataStream::Ok || magic != IMAGE_CACHE_MAGIC ||
+            version != IMAGE_CACHE_VERSION || byte_order != QSysInfo::ByteOrder ||
+            image_size != image_info.size() ||
+            image_modified != image_info.lastModified().toMSecsSinceEpoch() ||
+            format != QImage::Format_ARGB32_Premultiplied || width <= 0 || height <= 0 ||
+            bytes_per_line < width * 4 || cache_file->size() != IMAGE_CACHE_HEADER_SIZE + data_size) {
+        delete cache_file;
+        return QImage();
+    }
+
+    // The image uses the mapped file memory directly, and unmaps it when destroyed.
+    uchar *data = cache_file->map(0, cache_file->size());
+    if (!data) {
+        delete cache_file;
+        return QImage();
+    }
+
+    return QImage(static_cast<const uchar *>(data + IMAGE_CACHE_HEADER_SIZE), width, height,
+                  bytes_per_line, QImage::Format_ARGB32_Premultiplied,
+                  UnmapImageCache, cache_file);
+}
+
+
+void Tileset::_SaveImageCache(const QString &cache_filename, const QFileInfo &image_info,
+                              const QImage &image)
+{
+    if (cache_filename.isEmpty())
+        return;
+
+    QDir().mkpath(QFileInfo(cache_filename).absolutePath());
+    QSaveFile cache_file(cache_filename);
+    if (!cache_file.open(QIODevice::WriteOnly))
+        return;
+
+    QDataStream stream(&cache_file);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << IMAGE_CACHE_MAGIC << IMAGE_CACHE_VERSION << static_cast<qint32>(QSysInfo::ByteOrder)
+           << static_cast<qint64>(image_info.size())
+           << static_cast<qint64>(image_info.lastModified().toMSecsSinceEpoch())
+           << static_cast<qint32>(image.width()) << static_cast<qint32>(image.height())
+           << static_cast<qint32>(image.bytesPerLine()) << static_cast<qint32>(image.format())
+           << static_cast<quint32>(0); // Padding up to IMAGE_CACHE_HEADER_SIZE
+    stream.writeRawData(reinterpret_cast<const char *>(image.constBits()),
+                        image.bytesPerLine() * image.height());
+
+    if (stream.status() != QDataStream::Ok) {
+        cache_file.cancelWriting();
+        return;
+    }
+    cache_file.commit();
+}
+
+
+void Tileset::SetImage(const QImage &image)
+{
+    atlas = QPixmap::fromImage(image);
+    _initialized = true;
+} // Tileset::SetImage(...)
+
+
+void Tileset::UpdateWalkabilityMasks()
+{
+    for(uint32_t i = 0; i < 256; ++i) {
+        _walkability_masks[i] = 0;
+
+        std::map<int, std::vector<int32_t> >::const_iterator it = walkability.find(i);
+        if(it == walkability.end() || it->second.size() < 4)
+            continue;
+
+        const std::vector<int32_t> &corners = it->second;
+        if(corners[0] != 0)
+            _walkability_masks[i] |= NW_CORNER_MASK;
+        if(corners[1] != 0)
+            _walkability_masks[i] |= NE_CORNER_MASK;
+        if(corners[2] != 0)
+            _walkability_masks[i] |= SW_CORNER_MASK;
+        if(corners[3] != 0)
+            _walkability_masks[i] |= SE_CORNER_MASK;
+    }
+}
 
 
 bool Tileset::Save(const QString& root_folder)
@@ -342,15 +467,15 @@ TilesetTable::TilesetTable() :
     Tileset()
 {
     // Set up the QT table
-    table = new QTableWidget(num_rows, num_cols);
+    table = new QTableView();
+    table->setModel(new TilesetModel(table));
+    table->setItemDelegate(new TilesetDelegate(this, table));
     table->setShowGrid(false);
-    table->setSelectionMode(QTableWidget::ContiguousSelection);
-    table->setEditTriggers(QTableWidget::NoEditTriggers);
+    table->setSelectionMode(QTableView::ContiguousSelection);
+    table->setEditTriggers(QTableView::NoEditTriggers);
     table->setContentsMargins(0, 0, 0, 0);
     table->setDragEnabled(false);
     table->setAcceptDrops(false);
-    table->setHorizontalHeaderLabels(QStringList());
-    table->setVerticalHeaderLabels(QStringList());
     table->verticalHeader()->hide();
     table->verticalHeader()->setContentsMargins(0, 0, 0, 0);
     table->horizontalHeader()->hide();
@@ -371,34 +496,92 @@ TilesetTable::~TilesetTable()
 
 bool TilesetTable::Load(const QString &def_filename, const QString& root_folder)
 {
-    if (!Tileset::Load(def_filename, root_folder))
+    if (!LoadDefinition(def_filename, root_folder))
         return false;
 
-    // Read in tiles and create table items.
-    QRect rectangle;
-    QImage entire_tileset;
-    entire_tileset.load(root_folder + _tileset_image_filename, "png");
-    for(uint32_t row = 0; row < num_rows; ++row) {
-        for(uint32_t col = 0; col < num_cols; ++col) {
-            rectangle.setRect(col * TILE_WIDTH, row * TILE_HEIGHT, TILE_WIDTH,
-                              TILE_HEIGHT);
-            QVariant variant = entire_tileset.copy(rectangle);
-            if(!variant.isNull()) {
-                QTableWidgetItem *item = new QTableWidgetItem(QTableWidgetItem::UserType);
-                item->setData(Qt::DecorationRole, variant);
-                item->setFlags(item->flags() &~ Qt::ItemIsEditable);
-
-                table->setItem(row, col, item);
-            } else
-                qDebug("Image loading error!");
-        } // iterate through the columns of the tileset
-    } // iterate through the rows of the tileset
-
-
-    // Select the top left item
-    table->setCurrentCell(0, 0);
+    QImage image = DecodeImage(root_folder + _tileset_image_filename);
+    if (image.isNull())
+        return false;
 
+    SetImage(image);
+    _ResetTable();
     return true;
 }
 
+void TilesetTable::LoadShared(const std::shared_ptr<const Tileset>& tileset)
+{
+    // The tileset data is small, and the atlas pixmap is implicitly shared.
+    Tileset::operator=(*tileset);
+    _shared_tileset = tileset;
+    _ResetTable();
+}
+
+void TilesetTable::_ResetTable()
+{
+    // Select the top left tile
+    table->setCurrentIndex(table->model()->index(0, 0));
+    table->viewport()->update();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// TilesetModel class -- all functions
+////////////////////////////////////////////////////////////////////////////////
+
+TilesetModel::TilesetModel(QObject *parent) :
+    QAbstractTableModel(parent)
+{
+}
+
+int TilesetModel::rowCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : num_rows;
+}
+
+int TilesetModel::columnCount(const QModelIndex &parent) const
+{
+    return parent.isValid() ? 0 : num_cols;
+}
+
+QVariant TilesetModel::data(const QModelIndex &/*index*/, int /*role*/) const
+{
+    return QVariant();
+}
+
+Qt::ItemFlags TilesetModel::flags(const QModelIndex &index) const
+{
+    if(!index.isValid())
+        return Qt::NoItemFlags;
+    return Qt::ItemIsSelectable | Qt::ItemIsEnabled;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// TilesetDelegate class -- all functions
+////////////////////////////////////////////////////////////////////////////////
+
+TilesetDelegate::TilesetDelegate(const Tileset *tileset, QObject *parent) :
+    QStyledItemDelegate(parent),
+    _tileset(tileset)
+{
+}
+
+void TilesetDelegate::paint(QPainter *painter, const QStyleOptionViewItem &option,
+                            const QModelIndex &index) const
+{
+    painter->drawPixmap(option.rect.topLeft(), _tileset->atlas,
+                        Tileset::GetTileRect(index.row() * num_cols + index.column()));
+
+    // Show the selected tiles through the highlight color
+    if(option.state & QStyle::State_Selected) {
+        QColor highlight = option.palette.color(QPalette::Highlight);
+        highlight.setAlpha(128);
+        painter->fillRect(option.rect, highlight);
+    }
+}
+
+QSize TilesetDelegate::sizeHint(const QStyleOptionViewItem &/*option*/,
+                                const QModelIndex &/*index*/) const
+{
+    return QSize(TILE_WIDTH, TILE_HEIGHT);
+}
+
 } // namespace vt_editor
@@ -19,11 +19,17 @@
 #ifndef __TILESET_HEADER__
 #define __TILESET_HEADER__
 
+#include <QAbstractTableModel>
+#include <QFileInfo>
+#include <QImage>
 #include <QImageReader>
 #include <QRect>
-#include <QTableWidget>
+#include <QStyledItemDelegate>
+#include <QTableView>
 #include <QVariant>
 
+#include <memory>
+
 #include "script/script.h"
 
 //! All calls to the editor are wrapped in this namespace.
@@ -37,6 +43,15 @@ const unsigned int TILE_HEIGHT = 32;
 //@}
 
 
+//! \brief The bits of a tile walkability mask, set when the corner isn't walkable.
+enum WALKABILITY_MASK {
+    NW_CORNER_MASK = 0x01,
+    NE_CORNER_MASK = 0x02,
+    SW_CORNER_MASK = 0x04,
+    SE_CORNER_MASK = 0x08
+};
+
+
 /** ***************************************************************************
 *** \brief Represents an animated tile
 *** **************************************************************************/
@@ -68,17 +83,17 @@ public:
     virtual ~Tileset();
 
     //! \brief Returns the filename of a tileset image given the tileset's name
-    QString GetImageFilename() {
+    QString GetImageFilename() const {
         return _tileset_image_filename;
     }
 
     //! \brief Returns the filename of a tileset definition file given the tileset's name
-    QString GetDefintionFilename() {
+    QString GetDefintionFilename() const {
         return _tileset_definition_filename;
     }
 
     //! \brief Returns the filename of a tileset definition file given the tileset's name
-    QString GetTilesetName() {
+    QString GetTilesetName() const {
         return _tileset_name;
     }
 
@@ -99,37 +114,62 @@ public:
     /** \brief Creates a new tileset object using only a tileset image
     *** \param img_filename The path + name of the image file to use for the
     ***                     tileset
-    *** \param one_image If true, the tiles vector will contain a single image
-    ***                  for the entire tileset
     *** \return True if the tileset image was loaded successfully
     *** \note A tileset image is required to use this function, but nothing else
     **/
-    virtual bool New(const QString& img_filename, const QString& root_folder, bool one_image = false);
+    virtual bool New(const QString& img_filename, const QString& root_folder);
 
     /** \brief Loads the tileset definition file and stores its data in the
     ***        class containers
     *** \param def_filename The tileset definition filename.
-    *** \param one_image If true, the tiles vector will contain a single image
-    ***                  for the entire tileset
     *** \return True if the tileset was loaded successfully
     *** \note This function will clear the previously loaded contents when it
     ***       is called
     **/
-    virtual bool Load(const QString& def_filename, const QString& root_folder, bool one_image = false);
+    virtual bool Load(const QString& def_filename, const QString& root_folder);
+
+    /** \name Split Loading Functions
+    *** \brief Load() in three steps, so that images can be decoded by worker threads:
+    *** LoadDefinition() reads the definition file and must be called from the
+    *** main thread, as it uses the Lua state. DecodeImage() can be called from any
+    *** thread. SetImage() creates the atlas and must be called from the GUI thread.
+    **/
+    //{@
+    bool LoadDefinition(const QString& def_filename, const QString& root_folder);
+    static QImage DecodeImage(const QString& img_filename);
+    void SetImage(const QImage& image);
+    //@}
 
     /** \brief Saves the tileset data to its tileset definition file
     *** \return True if the save operation was successful
     **/
     bool Save(const QString& root_folder);
 
-    //! \brief Contains the QPixmap tiles of the tileset, used in grid.cpp.
+    //! \brief The whole tileset image, used in grid.cpp.
+    //! Tiles are drawn from it using GetTileRect().
     //! \note The QPixmap class is optimized to show pictures on screen,
     //! but QImage is used at load times at it is better in it.
-    std::vector<QPixmap> tiles;
+    QPixmap atlas;
+
+    //! \brief Returns the area of the given tile (0-255) in the atlas.
+    static QRect GetTileRect(int32_t tile_index) {
+        // Tilesets have 16 tiles per row
+        return QRect((tile_index % 16) * TILE_WIDTH, (tile_index / 16) * TILE_HEIGHT,
+                     TILE_WIDTH, TILE_HEIGHT);
+    }
 
     //! \brief Contains walkability information for each tile.
     std::map<int, std::vector<int32_t> > walkability;
 
+    //! \brief Returns the walkability of the 256 tiles as WALKABILITY_MASK bits.
+    const uint8_t *GetWalkabilityMasks() const {
+        return _walkability_masks;
+    }
+
+    //! \brief Recomputes the walkability masks from the walkability map.
+    //! Done when loading, and must be called after modifying walkability.
+    void UpdateWalkabilityMasks();
+
     //! \brief Contains autotiling information for any autotileable tile.
     std::map<int, std::string> autotileability;
 
@@ -146,9 +186,65 @@ protected:
 
     //! \brief Contains animated tile information for any animated tile.
     std::vector<std::vector<AnimatedTileData> > _animated_tiles;
+
+    //! \brief The walkability map content as one mask per tile.
+    uint8_t _walkability_masks[256];
+
+private:
+    /** \name Image Cache Functions
+    *** \brief The decoded tileset images kept in the user cache folder.
+    ***
+    *** The image pixels are stored as they are in memory, so that DecodeImage()
+    *** can map the cache file instead of inflating the PNG file. There is one
+    *** cache file per image path. It records the image size and modification
+    *** time, so a modified image is decoded again and its cache file replaced.
+    **/
+    //{@
+    //! \return The cache file name, or an empty string when no cache can be used.
+    static QString _GetImageCacheFilename(const QString& img_filename);
+    //! \return The image mapped from the cache, or a null image when the cache isn't valid.
+    static QImage _LoadImageCache(const QString& cache_filename, const QFileInfo& image_info);
+    static void _SaveImageCache(const QString& cache_filename, const QFileInfo& image_info,
+                                const QImage& image);
+    //@}
 }; // class Tileset
 
 
+/** ***************************************************************************
+*** \brief The 16x16 tiles of a tileset, as shown by the tileset tables.
+***
+*** The model holds no data, the tiles are drawn from the tileset atlas by
+*** the TilesetDelegate. Only the selection is kept by the view.
+*** **************************************************************************/
+class TilesetModel : public QAbstractTableModel
+{
+public:
+    TilesetModel(QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
+    Qt::ItemFlags flags(const QModelIndex &index) const;
+};
+
+
+/** ***************************************************************************
+*** \brief Draws the tiles of a tileset table from the tileset atlas.
+*** **************************************************************************/
+class TilesetDelegate : public QStyledItemDelegate
+{
+public:
+    TilesetDelegate(const Tileset *tileset, QObject *parent = nullptr);
+
+    void paint(QPainter *painter, const QStyleOptionViewItem &option, const QModelIndex &index) const;
+    QSize sizeHint(const QStyleOptionViewItem &option, const QModelIndex &index) const;
+
+private:
+    //! \brief The tileset whose atlas is drawn.
+    const Tileset *_tileset;
+};
+
+
 /** ***************************************************************************
 *** \brief Used to visually represent a tileset via a QT table
 *** **************************************************************************/
@@ -162,8 +258,19 @@ public:
     //! \brief Loads a tileset, using the given rootFolder for relative filenames.
     bool Load(const QString& def_filename, const QString& root_folder);
 
+    //! \brief Uses a tileset already loaded, as given by the TilesetCache.
+    //! The atlas is shared, and the tileset is referenced as long as this table exists.
+    void LoadShared(const std::shared_ptr<const Tileset>& tileset);
+
     //! Reference to the table implementation of this tileset
-    QTableWidget *table;
+    QTableView *table;
+
+private:
+    //! \brief The shared tileset this table was created from, if any.
+    std::shared_ptr<const Tileset> _shared_tileset;
+
+    //! \brief Redraws the table with the new atlas and selects the top left tile.
+    void _ResetTable();
 }; // class TilesetTable : public Tileset
 
 } // namespace vt_editor
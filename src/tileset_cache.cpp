@@ -0,0 +1,76 @@
+///////////////////////////////////////////////////////////////////////////////
+//            Copyright (C) 2004-2011 by The Allacrost Project
+//            Copyright (C) 2012-2015 by Bertram (Valyria Tear)
+//                         All Rights Reserved
+//
+// This code is licensed under the GNU GPL version 2. It is free software
+// and you may modify it and/or redistribute it under the terms of this license.
+// See http://www.gnu.org/copyleft/gpl.html for details.
+///////////////////////////////////////////////////////////////////////////////
+
+/** ***************************************************************************
+*** \file    tileset_cache.cpp
+*** \author  Yohann Ferreira, yohann ferreira orange fr
+*** \brief   Source file for the loaded tilesets cache.
+*** **************************************************************************/
+
+#include "tileset_cache.h"
+
+#include <QFileInfo>
+
+namespace vt_editor
+{
+
+std::shared_ptr<const Tileset> TilesetCache::Find(const QString &def_filename, const QString &root_folder)
+{
+    std::map<QString, CacheEntry>::iterator it = _entries.find(root_folder + def_filename);
+    if(it == _entries.end())
+        return std::shared_ptr<const Tileset>();
+
+    CacheEntry &entry = it->second;
+    if(QFileInfo(it->first).lastModified() != entry.definition_modified ||
+            QFileInfo(root_folder + entry.tileset->GetImageFilename()).lastModified() != entry.image_modified) {
+        // The maps still using the old tileset keep their reference to it.
+        _entries.erase(it);
+        return std::shared_ptr<const Tileset>();
+    }
+
+    entry.last_use = ++_use_counter;
+    return entry.tileset;
+}
+
+std::shared_ptr<const Tileset> TilesetCache::Insert(const QString &root_folder, Tileset *tileset)
+{
+    CacheEntry entry;
+    entry.tileset.reset(tileset);
+    entry.definition_modified = QFileInfo(root_folder + tileset->GetDefintionFilename()).lastModified();
+    entry.image_modified = QFileInfo(root_folder + tileset->GetImageFilename()).lastModified();
+    entry.last_use = ++_use_counter;
+
+    _entries[root_folder + tileset->GetDefintionFilename()] = entry;
+    _Prune();
+    return entry.tileset;
+}
+
+void TilesetCache::_Prune()
+{
+    for(;;) {
+        // Only the cache references an unused tileset.
+        uint32_t unused_count = 0;
+        std::map<QString, CacheEntry>::iterator oldest = _entries.end();
+        for(std::map<QString, CacheEntry>::iterator it = _entries.begin(); it != _entries.end(); ++it) {
+            if(it->second.tileset.use_count() > 1)
+                continue;
+
+            ++unused_count;
+            if(oldest == _entries.end() || it->second.last_use < oldest->second.last_use)
+                oldest = it;
+        }
+
+        if(unused_count <= MAX_UNUSED_TILESETS)
+            return;
+        _entries.erase(oldest);
+    }
+}
+
+} // namespace vt_editor
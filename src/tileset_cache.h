@@ -0,0 +1,84 @@
+///////////////////////////////////////////////////////////////////////////////
+//            Copyright (C) 2004-2011 by The Allacrost Project
+//            Copyright (C) 2012-2015 by Bertram (Valyria Tear)
+//                         All Rights Reserved
+//
+// This code is licensed under the GNU GPL version 2. It is free software
+// and you may modify it and/or redistribute it under the terms of this license.
+// See http://www.gnu.org/copyleft/gpl.html for details.
+///////////////////////////////////////////////////////////////////////////////
+
+/** ***************************************************************************
+*** \file    tileset_cache.h
+*** \author  Yohann Ferreira, yohann ferreira orange fr
+*** \brief   Header file for the loaded tilesets cache.
+*** **************************************************************************/
+
+#ifndef __TILESET_CACHE_HEADER__
+#define __TILESET_CACHE_HEADER__
+
+#include "tileset.h"
+
+#include <QDateTime>
+#include <QString>
+
+#include <map>
+#include <memory>
+
+namespace vt_editor
+{
+
+/** ***************************************************************************
+*** \brief Keeps the loaded tilesets, so that they are shared by the maps
+*** using them instead of being read from disk again.
+***
+*** Tilesets are referenced through shared pointers: a tileset is in use as
+*** long as a TilesetTable holds it. Unused tilesets are kept as well, so that
+*** reopening a map is instant, up to MAX_UNUSED_TILESETS of them.
+*** A tileset is loaded again once its definition or image file was modified.
+*** **************************************************************************/
+class TilesetCache
+{
+public:
+    TilesetCache():
+        _use_counter(0)
+    {}
+
+    /** \brief Returns the cached tileset, or nullptr when it isn't cached or
+    *** its files were modified since it was loaded.
+    **/
+    std::shared_ptr<const Tileset> Find(const QString &def_filename, const QString &root_folder);
+
+    /** \brief Adds a loaded tileset to the cache, which takes ownership of it.
+    *** \return The shared tileset to use.
+    **/
+    std::shared_ptr<const Tileset> Insert(const QString &root_folder, Tileset *tileset);
+
+private:
+    //! \brief The number of unused tilesets kept in memory.
+    static const uint32_t MAX_UNUSED_TILESETS = 16;
+
+    struct CacheEntry {
+        std::shared_ptr<const Tileset> tileset;
+
+        //! \brief The modification time of the tileset files when loaded.
+        QDateTime definition_modified;
+        QDateTime image_modified;
+
+        //! \brief The value of _use_counter when the tileset was last requested.
+        uint64_t last_use;
+    };
+
+    //! \brief The cached tilesets, by definition file full path.
+    std::map<QString, CacheEntry> _entries;
+
+    //! \brief Incremented on each request, to find the least recently used tilesets.
+    uint64_t _use_counter;
+
+    //! \brief Drops the least recently used unused tilesets, when there are too many.
+    void _Prune();
+};
+
+} // namespace vt_editor
+
+#endif // __TILESET_CACHE_HEADER__
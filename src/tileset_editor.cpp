@@ -66,7 +66,7 @@ void TilesetDisplay::UpdateScene()
     setBackgroundBrush(QBrush(Qt::gray));
 
     // Draw the tileset
-    addPixmap(tileset->tiles[0]);
+    addPixmap(tileset->atlas);
 
     // Draw transparent red over the unwalkable tile quadrants
     for(uint32_t i = 0; i < 16; ++i) {
@@ -178,6 +178,7 @@ void TilesetDisplay::_UpdateTiles(QGraphicsSceneMouseEvent *evt)
         tile_index = 3;
 
     tileset->walkability[tile_y * 16 + tile_x][tile_index] = _is_adding_collision;
+    tileset->UpdateWalkabilityMasks();
 
     UpdateScene();
 }
@@ -274,13 +275,13 @@ void TilesetEditor::_NewFile()
     // Remove the root folder from the file name
     QStringList file_parts = filename.split(_root_folder);
     QString relativeName = file_parts.count() > 1 ? file_parts.at(1) : filename;
-    if (!_tset_display->tileset->New(relativeName, _root_folder, true)) {
+    if (!_tset_display->tileset->New(relativeName, _root_folder)) {
         QMessageBox::warning(this, tr("Map Editor"),
                                 tr("Failed to create new tileset."));
     }
 
     // Set the background image
-    _tset_display->addPixmap(_tset_display->tileset->tiles[0]);
+    _tset_display->addPixmap(_tset_display->tileset->atlas);
 
     // Refreshes the scene
     _tset_display->UpdateScene();
@@ -307,7 +308,7 @@ void TilesetEditor::_OpenFile()
     // Remove the root folder from the file name
     QStringList file_parts = file_name.split(_root_folder);
     QString relativeName = file_parts.count() > 1 ? file_parts.at(1) : file_name;
-    if (!_tset_display->tileset->Load(relativeName, _root_folder, true)) {
+    if (!_tset_display->tileset->Load(relativeName, _root_folder)) {
         QMessageBox::warning(this, tr("Map Editor"),
                                 tr("Failed to load existing tileset."));
     }
@@ -0,0 +1,364 @@
+///////////////////////////////////////////////////////////////////////////////
+//            Copyright (C) 2004-2011 by The Allacrost Project
+//            Copyright (C) 2012-2015 by Bertram (Valyria Tear)
+//                         All Rights Reserved
+//
+// This code is licensed under the GNU GPL version 2. It is free software
+// and you may modify it and/or redistribute it under the terms of this license.
+// See http://www.gnu.org/copyleft/gpl.html for details.
+///////////////////////////////////////////////////////////////////////////////
+
+/** ***************************************************************************
+*** \file    undo_journal.cpp
+*** \author  Yohann Ferreira, yohann ferreira orange fr
+*** \brief   Source file for the journal of the unsaved map changes.
+*** **************************************************************************/
+
+#include "undo_journal.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDebug>
+#include <QFile>
+#include <QMutexLocker>
+
+namespace vt_editor
+{
+
+const quint32 JOURNAL_MAGIC = 0x56544a4c; // "VTJL"
+const quint32 JOURNAL_VERSION = 1;
+
+//! \brief The journal record types.
+const quint8 DELTA_RECORD = 1;
+const quint8 CHECKPOINT_RECORD = 2;
+
+//! \brief Frames a record payload with its type. The payload size is written
+//! as well, so that a record cut by a crash is detected.
+static QByteArray MakeRecord(quint8 type, const QByteArray &payload)
+{
+    QByteArray record;
+    QDataStream stream(&record, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << type << payload;
+    return record;
+}
+
+UndoJournal::UndoJournal() :
+    _deltas_since_checkpoint(0),
+    _stopping(false)
+{}
+
+UndoJournal::~UndoJournal()
+{
+    Stop(false);
+}
+
+void UndoJournal::Start(const QString &map_filename)
+{
+    Stop(true);
+
+    _map_hash = _GetMapHash(map_filename);
+    if(_map_hash.isEmpty())
+        return;
+
+    _map_filename = map_filename;
+    _journal_filename = _GetJournalFilename(map_filename);
+    _deltas_since_checkpoint = 0;
+    _stopping = false;
+    start(QThread::LowPriority);
+}
+
+void UndoJournal::Stop(bool remove_file)
+{
+    if(!IsStarted())
+        return;
+
+    {
+        QMutexLocker locker(&_mutex);
+        _stopping = true;
+    }
+    _condition.wakeAll();
+    wait();
+    _written_checkpoints.clear();
+
+    if(remove_file)
+        QFile::remove(_journal_filename);
+
+    _map_filename.clear();
+    _journal_filename.clear();
+    _map_hash.clear();
+}
+
+void UndoJournal::WriteDelta(uint32_t layer_id, const TileDelta &delta, bool undo)
+{
+    if(!IsStarted() || delta.IsEmpty())
+        return;
+
+    // Deltas are small, so they're serialized right away.
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << static_cast<quint32>(layer_id) << static_cast<quint8>(undo ? 1 : 0);
+    delta.Write(stream);
+
+    Entry entry;
+    entry.record = MakeRecord(DELTA_RECORD, payload);
+    _Push(std::move(entry));
+    ++_deltas_since_checkpoint;
+}
+
+void UndoJournal::WriteCheckpoint(const GridSnapshot &snapshot, const QStringList &tileset_names)
+{
+    if(!IsStarted())
+        return;
+
+    // Only the chunk pointers are copied here, the writer thread does the rest.
+    // The map then copies a chunk only when writing it.
+    Entry entry;
+    entry.checkpoint = std::make_shared<GridSnapshot>(snapshot);
+    entry.tileset_names = tileset_names;
+    _Push(std::move(entry));
+    _deltas_since_checkpoint = 0;
+}
+
+bool UndoJournal::Exists(const QString &map_filename)
+{
+    QFile file(_GetJournalFilename(map_filename));
+    if(!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_0);
+    quint32 magic = 0;
+    quint32 version = 0;
+    QByteArray map_hash;
+    stream >> magic >> version >> map_hash;
+
+    // A journal without any record holds nothing to restore
+    return stream.status() == QDataStream::Ok && magic == JOURNAL_MAGIC &&
+           version == JOURNAL_VERSION && !stream.atEnd();
+}
+
+bool UndoJournal::Replay(const QString &map_filename, const Grid *grid,
+                         GridSnapshot &map, QStringList &tileset_names)
+{
+    QFile file(_GetJournalFilename(map_filename));
+    if(!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_0);
+    quint32 magic = 0;
+    quint32 version = 0;
+    QByteArray map_hash;
+    stream >> magic >> version >> map_hash;
+    if(stream.status() != QDataStream::Ok || magic != JOURNAL_MAGIC ||
+            version != JOURNAL_VERSION || map_hash != _GetMapHash(map_filename))
+        return false;
+
+    // The records are applied on a copy of the saved map, which shares its
+    // tiles with the map until modified.
+    map = grid->GetSnapshot();
+    tileset_names = grid->tileset_def_names;
+    bool replayed = false;
+    while(!stream.atEnd()) {
+        quint8 type = 0;
+        QByteArray payload;
+        stream >> type >> payload;
+        // A record cut by the crash ends the journal
+        if(stream.status() != QDataStream::Ok)
+            break;
+
+        if(type == DELTA_RECORD) {
+            QDataStream record(payload);
+            record.setVersion(QDataStream::Qt_5_0);
+            quint32 layer_id = 0;
+            quint8 undo = 0;
+            TileDelta delta;
+            record >> layer_id >> undo;
+            if(!delta.Read(record) || layer_id >= map.layers.size())
+                return false;
+            delta.Apply(map.layers[layer_id].tiles, undo != 0);
+        }
+        else if(type == CHECKPOINT_RECORD) {
+            if(!_ReadCheckpointRecord(payload, map, tileset_names))
+                return false;
+        }
+        else {
+            return false;
+        }
+        replayed = true;
+    }
+
+    return replayed;
+}
+
+void UndoJournal::run()
+{
+    QFile file(_journal_filename);
+    bool file_ok = file.open(QIODevice::WriteOnly | QIODevice::Truncate);
+    if(file_ok) {
+        QDataStream stream(&file);
+        stream.setVersion(QDataStream::Qt_5_0);
+        stream << JOURNAL_MAGIC << JOURNAL_VERSION << _map_hash;
+        file_ok = stream.status() == QDataStream::Ok && file.flush();
+    }
+    if(!file_ok)
+        qDebug() << "Couldn't write the undo journal:" << _journal_filename;
+
+    forever {
+        std::deque<Entry> entries;
+        {
+            QMutexLocker locker(&_mutex);
+            while(_entries.empty() && !_stopping)
+                _condition.wait(&_mutex);
+            // Stopping, and everything was written
+            if(_entries.empty())
+                break;
+            entries.swap(_entries);
+        }
+
+        if(file_ok) {
+            for(std::deque<Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+                if(it->checkpoint)
+                    file.write(MakeRecord(CHECKPOINT_RECORD, _WriteCheckpointRecord(*it->checkpoint, it->tileset_names)));
+                else
+                    file.write(it->record);
+            }
+            file.flush();
+        }
+
+        // Freeing the checkpoints here would let the map write their chunks
+        // in place without synchronizing with the reads above.
+        QMutexLocker locker(&_mutex);
+        for(std::deque<Entry>::iterator it = entries.begin(); it != entries.end(); ++it) {
+            if(it->checkpoint)
+                _written_checkpoints.push_back(std::move(*it));
+        }
+    }
+}
+
+void UndoJournal::_Push(Entry &&entry)
+{
+    // The checkpoints written are freed once out of the lock.
+    std::deque<Entry> written_checkpoints;
+    {
+        QMutexLocker locker(&_mutex);
+        _entries.push_back(std::move(entry));
+        written_checkpoints.swap(_written_checkpoints);
+    }
+    _condition.wakeOne();
+}
+
+QByteArray UndoJournal::_WriteCheckpointRecord(const GridSnapshot &snapshot, const QStringList &tileset_names)
+{
+    QByteArray payload;
+    QDataStream stream(&payload, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_0);
+
+    stream << static_cast<quint32>(snapshot.width) << static_cast<quint32>(snapshot.height)
+           << tileset_names << static_cast<quint32>(snapshot.layers.size());
+
+    std::vector<int32_t> row(snapshot.width);
+    std::vector<int32_t> runs;
+    for(uint32_t layer_id = 0; layer_id < snapshot.layers.size(); ++layer_id) {
+        const Layer &layer = snapshot.layers[layer_id];
+        stream << static_cast<qint32>(layer.layer_type) << QString::fromStdString(layer.name)
+               << static_cast<quint8>(layer.tiles.IsSparse() ? 1 : 0)
+               << static_cast<quint8>(layer.visible ? 1 : 0);
+
+        // The tiles are run-length encoded, row after row: (count, tile id)
+        runs.clear();
+        for(uint32_t y = 0; y < snapshot.height; ++y) {
+            layer.tiles.GetRow(y, row.data());
+            for(uint32_t x = 0; x < snapshot.width; ++x) {
+                if(!runs.empty() && runs.back() == row[x])
+                    ++runs[runs.size() - 2];
+                else {
+                    runs.push_back(1);
+                    runs.push_back(row[x]);
+                }
+            }
+        }
+
+        stream << static_cast<quint32>(runs.size());
+        for(uint32_t i = 0; i < runs.size(); ++i)
+            stream << static_cast<qint32>(runs[i]);
+    }
+
+    return payload;
+}
+
+bool UndoJournal::_ReadCheckpointRecord(const QByteArray &record, GridSnapshot &snapshot,
+                                        QStringList &tileset_names)
+{
+    QDataStream stream(record);
+    stream.setVersion(QDataStream::Qt_5_0);
+
+    quint32 width = 0;
+    quint32 height = 0;
+    QStringList names;
+    quint32 layers_num = 0;
+    stream >> width >> height >> names >> layers_num;
+    if(stream.status() != QDataStream::Ok || width == 0 || height == 0)
+        return false;
+
+    // Read everything before touching the given snapshot
+    std::vector<Layer> layers;
+    std::vector<int32_t> tiles;
+    for(uint32_t layer_id = 0; layer_id < layers_num; ++layer_id) {
+        qint32 layer_type = INVALID_LAYER;
+        QString name;
+        quint8 sparse = 0;
+        quint8 visible = 1;
+        quint32 runs_size = 0;
+        stream >> layer_type >> name >> sparse >> visible >> runs_size;
+        if(stream.status() != QDataStream::Ok || (layer_type != GROUND_LAYER && layer_type != SKY_LAYER) ||
+                runs_size % 2 != 0 || runs_size > stream.device()->bytesAvailable() / 4)
+            return false;
+
+        tiles.clear();
+        for(uint32_t i = 0; i < runs_size; i += 2) {
+            qint32 count = 0;
+            qint32 tile_id = -1;
+            stream >> count >> tile_id;
+            if(count <= 0 || tiles.size() + count > static_cast<size_t>(width) * height)
+                return false;
+            tiles.insert(tiles.end(), static_cast<size_t>(count), static_cast<int32_t>(tile_id));
+        }
+        if(stream.status() != QDataStream::Ok || tiles.size() != static_cast<size_t>(width) * height)
+            return false;
+
+        layers.push_back(Layer());
+        Layer &layer = layers.back();
+        layer.layer_type = static_cast<LAYER_TYPE>(layer_type);
+        layer.name = name.toStdString();
+        layer.visible = visible != 0;
+        layer.tiles.SetSparse(sparse != 0);
+        layer.Resize(width, height);
+        for(uint32_t y = 0; y < height; ++y)
+            layer.tiles.SetRow(y, &tiles[y * width]);
+    }
+
+    snapshot.width = width;
+    snapshot.height = height;
+    snapshot.layers.swap(layers);
+    tileset_names = names;
+    return true;
+}
+
+QString UndoJournal::_GetJournalFilename(const QString &map_filename)
+{
+    return map_filename + ".journal";
+}
+
+QByteArray UndoJournal::_GetMapHash(const QString &map_filename)
+{
+    QFile map_file(map_filename);
+    if(!map_file.open(QIODevice::ReadOnly))
+        return QByteArray();
+
+    return QCryptographicHash::hash(map_file.readAll(), QCryptographicHash::Sha1);
+}
+
+} // namespace vt_editor
@@ -0,0 +1,161 @@
+///////////////////////////////////////////////////////////////////////////////
+//            Copyright (C) 2004-2011 by The Allacrost Project
+//            Copyright (C) 2012-2015 by Bertram (Valyria Tear)
+//                         All Rights Reserved
+//
+// This code is licensed under the GNU GPL version 2. It is free software
+// and you may modify it and/or redistribute it under the terms of this license.
+// See http://www.gnu.org/copyleft/gpl.html for details.
+///////////////////////////////////////////////////////////////////////////////
+
+/** ***************************************************************************
+*** \file    undo_journal.h
+*** \author  Yohann Ferreira, yohann ferreira orange fr
+*** \brief   Header file for the journal of the unsaved map changes.
+*** **************************************************************************/
+
+#ifndef __UNDO_JOURNAL_HEADER__
+#define __UNDO_JOURNAL_HEADER__
+
+#include "grid.h"
+#include "tile_delta.h"
+
+#include <QByteArray>
+#include <QMutex>
+#include <QStringList>
+#include <QThread>
+#include <QWaitCondition>
+
+#include <deque>
+#include <memory>
+
+namespace vt_editor
+{
+
+/** ***************************************************************************
+*** \brief Keeps the unsaved changes of a map on disk, so that they can be
+*** restored after a crash.
+***
+*** The journal is written next to the map file and only ever appended to.
+*** It starts with the hash of the saved map, followed by records of:
+*** - Tile deltas, as done or undone by the layer undo commands.
+*** - Checkpoints holding the whole map. They are written when the map
+*** structure changes, and regularly between tile deltas so that the deltas
+*** to replay stay few.
+***
+*** The records are written by a background thread, so that editing the map
+*** never waits for the disk. Checkpoints are map snapshots sharing their
+*** tile chunks with the map, they are only serialized by that thread.
+*** Since the map copies the chunks it still shares before writing them, the
+*** checkpoints are only freed by the editor thread, once it synchronized
+*** with the writer thread. A chunk is thus never written by the map while
+*** being read by the writer thread.
+***
+*** The journal is restarted each time the map is saved, and removed when the
+*** map is closed.
+*** **************************************************************************/
+class UndoJournal : public QThread
+{
+public:
+    UndoJournal();
+
+    //! \brief Waits for the pending records, keeping the journal file.
+    ~UndoJournal();
+
+    /** \brief Starts a new journal for the given saved map file, replacing
+    *** the previous one, and removing it if it was for another map.
+    **/
+    void Start(const QString &map_filename);
+
+    //! \brief Writes the pending records and stops the journal.
+    //! \param remove_file Whether the journal file is removed.
+    void Stop(bool remove_file);
+
+    bool IsStarted() const {
+        return !_map_filename.isEmpty();
+    }
+
+    //! \brief Records tile changes done on a layer, or undone when undo is true.
+    void WriteDelta(uint32_t layer_id, const TileDelta &delta, bool undo);
+
+    //! \brief Records the whole map.
+    void WriteCheckpoint(const GridSnapshot &snapshot, const QStringList &tileset_names);
+
+    //! \brief Tells whether enough deltas were written since the last checkpoint
+    //! that a new one should be.
+    bool IsCheckpointDue() const {
+        return _deltas_since_checkpoint >= CHECKPOINT_INTERVAL;
+    }
+
+    //! \brief Tells whether a journal was left for the given map file.
+    static bool Exists(const QString &map_filename);
+
+    /** \brief Reads back the changes found in the journal of the given map file.
+    ***
+    *** The journal must have been started on the map file as currently saved.
+    *** The grid itself is left untouched: the changes are applied on a copy of it.
+    *** \param map Set to the map content found at the end of the journal.
+    *** \param tileset_names Set to the tileset list the map tile ids refer to, which
+    *** differs from the saved one when the tilesets were changed meanwhile.
+    *** \return False when the journal can't be replayed.
+    **/
+    static bool Replay(const QString &map_filename, const Grid *grid,
+                       GridSnapshot &map, QStringList &tileset_names);
+
+protected:
+    //! \brief The writer thread loop.
+    void run();
+
+private:
+    //! \brief The number of deltas between two checkpoints.
+    static const uint32_t CHECKPOINT_INTERVAL = 256;
+
+    //! \brief A record waiting to be written.
+    struct Entry {
+        //! \brief The serialized record, empty for checkpoints.
+        QByteArray record;
+        //! \brief The map to serialize, for checkpoints.
+        std::shared_ptr<GridSnapshot> checkpoint;
+        QStringList tileset_names;
+    };
+
+    //! \brief The map file, and the journal one used by the writer thread.
+    QString _map_filename;
+    QString _journal_filename;
+
+    //! \brief The hash of the saved map file, written in the journal header.
+    QByteArray _map_hash;
+
+    uint32_t _deltas_since_checkpoint;
+
+    //! \brief The records to write, the checkpoints written to free,
+    //! and whether the writer thread must stop.
+    //! They are protected by the mutex.
+    //{@
+    QMutex _mutex;
+    QWaitCondition _condition;
+    std::deque<Entry> _entries;
+    std::deque<Entry> _written_checkpoints;
+    bool _stopping;
+    //@}
+
+    //! \brief Queues a record for the writer thread, and frees the checkpoints written.
+    void _Push(Entry &&entry);
+
+    //! \brief Serializes a checkpoint record.
+    static QByteArray _WriteCheckpointRecord(const GridSnapshot &snapshot, const QStringList &tileset_names);
+
+    //! \brief Reads a checkpoint record.
+    //! \return False when the record isn't valid.
+    static bool _ReadCheckpointRecord(const QByteArray &record, GridSnapshot &snapshot,
+                                      QStringList &tileset_names);
+
+    static QString _GetJournalFilename(const QString &map_filename);
+
+    //! \brief Returns the hash identifying the saved map file content, or an empty array.
+    static QByteArray _GetMapHash(const QString &map_filename);
+};
+
+} // namespace vt_editor
+
+#endif // __UNDO_JOURNAL_HEADER__